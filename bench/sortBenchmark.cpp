@@ -0,0 +1,145 @@
+// Compares sortScatterers against the recursive quicksort that phantom::sortScatterer used
+// before, on freshly generated and on displaced (nearly sorted) phantoms.
+//
+//     ./sortBenchmark [scatterers] [threads]
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "./counterRng.h"
+#include "./phantom.h"
+#include "./scattererSort.h"
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+#define Swap(a, b) temp = a; a = b; b = temp;
+
+/*!  The middle pivot quicksort formerly in phantom.cpp, kept here as the reference
+ */
+void partition(scatterer* A, int64_t F, int64_t L, int64_t* PivotIndex) {
+    int64_t pivotind = (F+L)/2;
+    scatterer temp;
+    Swap(A[F], A[pivotind]);
+    scatterer Pivot = A[F];
+    int64_t LastS1 = F;
+    int64_t FirstUnknown = F+1;
+
+    for (; FirstUnknown <= L; ++FirstUnknown) {
+        if ( A[FirstUnknown].x < Pivot.x ) {
+            ++LastS1;
+            Swap(A[FirstUnknown], A[LastS1]);
+        }
+    }
+
+    Swap(A[F], A[LastS1]);
+
+    *PivotIndex = LastS1;
+}
+
+void quickSort(scatterer *A, int64_t F, int64_t L) {
+    int64_t PivotIndex;
+    if (F < L) {
+        if (F == (L-1)) {
+            if (A[F].x > A[L].x) {
+                scatterer temp;
+                Swap(A[F], A[L]);
+            }
+            return;
+        }
+        partition(A, F, L, &PivotIndex);
+        quickSort(A, F, PivotIndex-1);
+        quickSort(A, PivotIndex+1, L);
+    }
+}
+
+bool isSorted(const std::vector<scatterer>& v) {
+    for (size_t i = 1; i < v.size(); i++)
+        if (v[i].x < v[i-1].x) return false;
+    return true;
+}
+
+template <typename Sort>
+double timeSort(const std::vector<scatterer>& input, Sort sort) {
+    std::vector<scatterer> v(input);
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    sort(v.data(), static_cast<int64_t>(v.size()));
+    std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+    if (!isSorted(v)) {
+        cout << "Error! Output is not sorted" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return std::chrono::duration<double>(t1 - t0).count();
+}
+
+void compare(const char* name, const std::vector<scatterer>& input, int threads) {
+    double quick = timeSort(input, [](scatterer* d, int64_t n) {
+        quickSort(d, 0, n-1);
+    });
+    double radix = timeSort(input, [threads](scatterer* d, int64_t n) {
+        radixSortScatterers(d, n, threads);
+    });
+    double merge = timeSort(input, [threads](scatterer* d, int64_t n) {
+        mergeSortScattererRuns(d, n, threads);
+    });
+    double chosen = timeSort(input, [threads](scatterer* d, int64_t n) {
+        sortScatterers(d, n, threads);
+    });
+
+    cout << name << ":\n"
+         << "  quickSort            " << quick << " s\n"
+         << "  radix sort           " << radix << " s (" << quick/radix << "x)\n"
+         << "  run merge sort       " << merge << " s (" << quick/merge << "x)\n"
+         << "  sortScatterers       " << chosen << " s (" << quick/chosen << "x)"
+         << endl;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int64_t n = argc > 1 ? atoll(argv[1]) : 4000000;
+    int threads = argc > 2 ? atoi(argv[2]) : 0;
+    cout << "Sorting " << n << " scatterers" << endl;
+
+    // a fresh phantom, 4 cm wide
+    counterRng rng(1, 0);
+    std::vector<scatterer> fresh(n);
+    for (int64_t i = 0; i < n; i++) {
+        fresh[i].x = rng.uniform()*0.04;
+        fresh[i].y = rng.uniform()*0.04;
+        fresh[i].z = rng.uniform()*0.04;
+    }
+    compare("Fresh phantom", fresh, threads);
+
+    // the same phantom sorted and then displaced, as by displaceAnsys
+    std::vector<scatterer> sorted(fresh);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const scatterer& a, const scatterer& b) { return a.x < b.x; });
+
+    // a uniform 1% lateral expansion keeps the order apart from rounding
+    std::vector<scatterer> displaced(sorted);
+    for (int64_t i = 0; i < n; i++)
+        displaced[i].x += 0.01*(displaced[i].x - 0.02);
+    compare("Uniformly expanded phantom", displaced, threads);
+
+    // jitter of up to 0.1 um reorders close neighbours only
+    displaced = sorted;
+    for (int64_t i = 0; i < n; i++)
+        displaced[i].x += (rng.uniform() - 0.5)*0.2e-6;
+    compare("Locally disturbed phantom", displaced, threads);
+
+    // a lateral expansion growing with depth moves scatterers past many others
+    displaced = sorted;
+    for (int64_t i = 0; i < n; i++)
+        displaced[i].x += 0.01*(displaced[i].x - 0.02)*displaced[i].z/0.04;
+    compare("Depth dependent expansion", displaced, threads);
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef COMMON_COUNTERRNG_H_
+#define COMMON_COUNTERRNG_H_
+
+#include <stdint.h>
+
+/*! \brief A counter-based random number generator (Philox4x32-10, Salmon et al. 2011).
+ *
+ * Every (seed, stream) pair gives an independent sequence that needs no state from any other
+ * sequence, so each part of a job can draw its own numbers on any thread and the result does
+ * not depend on how the work was split up.
+ */
+class counterRng {
+ public:
+  counterRng(uint64_t seed, uint64_t stream) : used(4) {
+      key[0] = static_cast<uint32_t>(seed);
+      key[1] = static_cast<uint32_t>(seed >> 32);
+      counter[0] = 0;
+      counter[1] = 0;
+      counter[2] = static_cast<uint32_t>(stream);
+      counter[3] = static_cast<uint32_t>(stream >> 32);
+  }
+
+  uint32_t nextUint() {
+      if (used == 4) refill();
+      return out[used++];
+  }
+
+  // uniform on [0, 1), with 53 random bits
+  double uniform() {
+      uint64_t hi = nextUint() >> 5;
+      uint64_t lo = nextUint() >> 6;
+      return (hi*67108864.0 + lo)/9007199254740992.0;
+  }
+
+ private:
+  uint32_t key[2];
+  uint32_t counter[4];
+  uint32_t out[4];
+  int used;
+
+  static void mulhilo(uint32_t a, uint32_t b, uint32_t* hi, uint32_t* lo) {
+      uint64_t product = static_cast<uint64_t>(a)*b;
+      *hi = static_cast<uint32_t>(product >> 32);
+      *lo = static_cast<uint32_t>(product);
+  }
+
+  void refill() {
+      uint32_t c[4] = {counter[0], counter[1], counter[2], counter[3]};
+      uint32_t k[2] = {key[0], key[1]};
+      for (int round = 0; round < 10; round++) {
+          uint32_t hi0, lo0, hi1, lo1;
+          mulhilo(0xD2511F53u, c[0], &hi0, &lo0);
+          mulhilo(0xCD9E8D57u, c[2], &hi1, &lo1);
+          c[0] = hi1 ^ c[1] ^ k[0];
+          c[1] = lo1;
+          c[2] = hi0 ^ c[3] ^ k[1];
+          c[3] = lo0;
+          k[0] += 0x9E3779B9u;
+          k[1] += 0xBB67AE85u;
+      }
+      for (int i = 0; i < 4; i++) out[i] = c[i];
+      used = 0;
+
+      // the low 64 bits of the counter count blocks within the stream
+      if (++counter[0] == 0) ++counter[1];
+  }
+};
+
+#endif  // COMMON_COUNTERRNG_H_
@@ -0,0 +1,284 @@
+#include "./displacement.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char displacementMagic[8] = {'U', 'S', 'D', 'I', 'S', 'P', 'L', '\0'};
+const uint32_t displacementVersion = 1;
+const uint32_t endianMark = 0x01020304;
+
+// scatterers copied into the x, y and z arrays at a time
+const int64_t blockSize = 256;
+
+// below this many scatterers everything is done on the calling thread
+const int64_t parallelThreshold = 1 << 16;
+
+}  // namespace
+
+displacementField::displacementField() {
+    for (int d = 0; d < 3; d++) {
+        points[d] = 1;
+        origin[d] = 0;
+        spacing[d] = 1;
+    }
+}
+
+void displacementField::setGrid(const uint64_t pts[3],
+                                const double org[3],
+                                const double step[3],
+                                const std::vector<double>& uIn,
+                                const std::vector<double>& vIn,
+                                const std::vector<double>& wIn) {
+    for (int d = 0; d < 3; d++) {
+        points[d] = pts[d];
+        origin[d] = org[d];
+        spacing[d] = step[d];
+    }
+    u = uIn;
+    v = threeDimensional() ? vIn : std::vector<double>();
+    w = wIn;
+}
+
+/*!  Read a displacement file, see displacementFileHeader.  The old square files are told apart
+ * by their missing magic.  Files written by matlab_scripts/createDisFile.m start with the grid
+ * size as an int32, which is skipped when the file size shows it is there.
+ */
+int displacementField::loadFile(const char* filename, const myVector& phanSize,
+                                int legacySize) {
+    std::ifstream fpdisp(filename, std::ios::binary);
+    if (!fpdisp.is_open()) {
+        cout << "Error! Can't find file " << filename << endl;
+        return 0;
+    }
+
+    displacementFileHeader header;
+    memset(&header, 0, sizeof(header));
+    fpdisp.read(reinterpret_cast<char*>(&header), sizeof(header));
+    bool current = fpdisp.gcount() == sizeof(header) &&
+                   memcmp(header.magic, displacementMagic, sizeof(displacementMagic)) == 0;
+
+    if (current) {
+        if (header.endian != endianMark) {
+            cout << "Displacement file " << filename
+                 << " was written on a machine of different byte order" << endl;
+            return 0;
+        }
+        if (header.version > displacementVersion) {
+            cout << "Displacement file " << filename << " has version " << header.version
+                 << ", this program reads up to version " << displacementVersion << endl;
+            return 0;
+        }
+        if ((header.dimensions != 2 && header.dimensions != 3) ||
+            (header.dimensions == 2 && header.points[1] != 1)) {
+            cout << "Displacement file " << filename << " has an unknown grid" << endl;
+            return 0;
+        }
+        for (int d = 0; d < 3; d++) {
+            if (header.points[d] == 0 || !(header.spacing[d] > 0)) {
+                cout << "Displacement file " << filename << " has an empty grid" << endl;
+                return 0;
+            }
+            points[d] = header.points[d];
+            origin[d] = header.origin[d];
+            spacing[d] = header.spacing[d];
+        }
+
+        size_t count = points[0]*points[1]*points[2];
+        u.resize(count);
+        v.resize(header.dimensions == 3 ? count : 0);
+        w.resize(count);
+        fpdisp.read(reinterpret_cast<char*>(u.data()), count*sizeof(double));
+        fpdisp.read(reinterpret_cast<char*>(v.data()), v.size()*sizeof(double));
+        fpdisp.read(reinterpret_cast<char*>(w.data()), count*sizeof(double));
+    } else {
+        if (legacySize < 2) {
+            cout << "Error! The displacement matrix size must be at least 2" << endl;
+            return 0;
+        }
+        size_t count = static_cast<size_t>(legacySize)*legacySize;
+
+        fpdisp.clear();
+        fpdisp.seekg(0, std::ios::end);
+        std::streamoff fileBytes = fpdisp.tellg();
+        std::streamoff skip = fileBytes == static_cast<std::streamoff>(
+                                  sizeof(int32_t) + 2*count*sizeof(double)) ? 4 : 0;
+        fpdisp.seekg(skip, std::ios::beg);
+
+        double phsize = std::max(phanSize.x, phanSize.z);
+        points[0] = legacySize;
+        points[1] = 1;
+        points[2] = legacySize;
+        for (int d = 0; d < 3; d++) {
+            origin[d] = 0;
+            spacing[d] = phsize/(legacySize - 1);
+        }
+
+        u.resize(count);
+        v.clear();
+        w.resize(count);
+        fpdisp.read(reinterpret_cast<char*>(u.data()), count*sizeof(double));
+        fpdisp.read(reinterpret_cast<char*>(w.data()), count*sizeof(double));
+        for (size_t i = 0; i < count; i++) {
+            u[i] *= phsize;
+            w[i] *= phsize;
+        }
+    }
+
+    if (!fpdisp) {
+        cout << "Error! Displacement file " << filename << " is too short" << endl;
+        return 0;
+    }
+    return 1;
+}
+
+int displacementField::saveFile(const char* filename) const {
+    std::ofstream fpout(filename, std::ios::binary);
+    if (!fpout.is_open()) {
+        cout << "unable to create displacement file " << filename << endl;
+        return 0;
+    }
+
+    displacementFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, displacementMagic, sizeof(displacementMagic));
+    header.version = displacementVersion;
+    header.endian = endianMark;
+    header.dimensions = threeDimensional() ? 3 : 2;
+    for (int d = 0; d < 3; d++) {
+        header.points[d] = points[d];
+        header.origin[d] = origin[d];
+        header.spacing[d] = spacing[d];
+    }
+
+    fpout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fpout.write(reinterpret_cast<const char*>(u.data()), u.size()*sizeof(double));
+    fpout.write(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(double));
+    fpout.write(reinterpret_cast<const char*>(w.data()), w.size()*sizeof(double));
+    fpout.close();
+    if (!fpout) {
+        cout << "error writing displacement file " << filename << endl;
+        return 0;
+    }
+    return 1;
+}
+
+/*!  Displace up to blockSize scatterers.  After copying the positions into separate arrays,
+ * one loop works out the grid cell of every scatterer and its position within the cell, and
+ * another gathers and weights the corners of the cells.
+ */
+template <bool threeD>
+void displacementField::displaceBlock(scatterer* data, int64_t count) const {
+    double px[blockSize], py[blockSize], pz[blockSize];
+    double fx[blockSize], fy[blockSize], fz[blockSize];
+    int64_t cell[blockSize];
+    bool inside[blockSize];
+
+    const int64_t strideX = points[1]*points[2];
+    const int64_t strideY = points[2];
+    const double lastX = static_cast<double>(points[0] - 1);
+    const double lastY = static_cast<double>(points[1] - 1);
+    const double lastZ = static_cast<double>(points[2] - 1);
+
+    for (int64_t i = 0; i < count; i++) {
+        px[i] = data[i].x;
+        py[i] = data[i].y;
+        pz[i] = data[i].z;
+    }
+
+    for (int64_t i = 0; i < count; i++) {
+        double tx = (px[i] - origin[0])/spacing[0];
+        double ty = threeD ? (py[i] - origin[1])/spacing[1] : 0;
+        double tz = (pz[i] - origin[2])/spacing[2];
+
+        inside[i] = tx >= 0 && tx <= lastX && tz >= 0 && tz <= lastZ &&
+                    (!threeD || (ty >= 0 && ty <= lastY));
+
+        // a point on the far edge of the grid uses the last cell
+        double ix = std::min(std::floor(tx), lastX - 1);
+        double iy = threeD ? std::min(std::floor(ty), lastY - 1) : 0;
+        double iz = std::min(std::floor(tz), lastZ - 1);
+        fx[i] = tx - ix;
+        fy[i] = ty - iy;
+        fz[i] = tz - iz;
+        cell[i] = inside[i] ? static_cast<int64_t>(ix)*strideX
+                            + static_cast<int64_t>(iy)*strideY
+                            + static_cast<int64_t>(iz) : 0;
+    }
+
+    for (int64_t i = 0; i < count; i++) {
+        if (!inside[i]) continue;
+        const int64_t c = cell[i];
+        const double x1 = fx[i], x0 = 1 - x1;
+        const double z1 = fz[i], z0 = 1 - z1;
+
+        if (threeD) {
+            const double y1 = fy[i], y0 = 1 - y1;
+            const double wt[8] = {x0*y0*z0, x0*y0*z1, x0*y1*z0, x0*y1*z1,
+                                  x1*y0*z0, x1*y0*z1, x1*y1*z0, x1*y1*z1};
+            const int64_t at[8] = {c, c + 1, c + strideY, c + strideY + 1,
+                                   c + strideX, c + strideX + 1,
+                                   c + strideX + strideY, c + strideX + strideY + 1};
+            double du = 0, dv = 0, dw = 0;
+            for (int k = 0; k < 8; k++) {
+                du += wt[k]*u[at[k]];
+                dv += wt[k]*v[at[k]];
+                dw += wt[k]*w[at[k]];
+            }
+            data[i].x += du;
+            data[i].y += dv;
+            data[i].z += dw;
+        } else {
+            const double wt[4] = {x0*z0, x0*z1, x1*z0, x1*z1};
+            const int64_t at[4] = {c, c + 1, c + strideX, c + strideX + 1};
+            double du = 0, dw = 0;
+            for (int k = 0; k < 4; k++) {
+                du += wt[k]*u[at[k]];
+                dw += wt[k]*w[at[k]];
+            }
+            data[i].x += du;
+            data[i].z += dw;
+        }
+    }
+}
+
+/*!  Move the scatterers by the field.  Each thread takes a contiguous range of blocks.
+ */
+void displacementField::displace(scatterer* data, int64_t n, int threads) const {
+    if (points[0] < 2 || points[2] < 2 || (threeDimensional() && points[1] < 2)) {
+        cout << "Error! A displacement grid needs at least two points along each axis"
+             << endl;
+        return;
+    }
+
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (n < parallelThreshold) threads = 1;
+
+    int64_t blocks = (n + blockSize - 1)/blockSize;
+    auto work = [&](int t) {
+        for (int64_t b = blocks*t/threads; b < blocks*(t + 1)/threads; b++) {
+            int64_t first = b*blockSize;
+            int64_t count = std::min(blockSize, n - first);
+            if (threeDimensional())
+                displaceBlock<true>(data + first, count);
+            else
+                displaceBlock<false>(data + first, count);
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(work, t));
+    work(0);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
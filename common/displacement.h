@@ -0,0 +1,74 @@
+#ifndef COMMON_DISPLACEMENT_H_
+#define COMMON_DISPLACEMENT_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "./phantom.h"
+
+/*! \brief The header of a displacement file.
+ *
+ * The header is followed by the lateral (u), elevational (v, 3-D grids only) and axial (w)
+ * displacements, each an array of points[0]*points[1]*points[2] doubles in meters.  Grid
+ * point (ix, iy, iz) is at origin + (ix, iy, iz)*spacing and is stored at index
+ * (ix*points[1] + iy)*points[2] + iz, so z runs fastest as in the old square .dis files.
+ * A 2-D grid has points[1] == 1 and is the same at every elevation.
+ */
+struct displacementFileHeader {
+    char magic[8];       // "USDISPL" and a terminating zero
+    uint32_t version;
+    uint32_t endian;     // 0x01020304 as written by the machine that wrote it
+    uint32_t dimensions; // 2 for (u, w) on an x-z grid, 3 for (u, v, w) on an x-y-z grid
+    uint32_t pad;
+    uint64_t points[3];  // grid points along x, y and z
+    double origin[3];    // position of the first grid point
+    double spacing[3];   // grid step along x, y and z
+    char reserved[32];   // zero, room for later versions
+};
+
+/*! \brief A displacement field sampled on a rectangular 2-D or 3-D grid.
+ *
+ * Scatterers are moved by the trilinear (bilinear for 2-D grids) interpolation of the grid.
+ * Scatterers outside the grid are not moved, like in phantom::displaceAnsys.  The scatterers
+ * are worked on in blocks, copied into separate x, y and z arrays so the interpolation
+ * weights are computed in loops the compiler can vectorize, and the blocks are shared out
+ * over threads.  The result does not depend on the thread count.
+ */
+class displacementField {
+ public:
+  displacementField();
+
+  // read a displacement file.  Files without a displacementFileHeader are the
+  // old format: square legacySize x legacySize grids of lateral and axial
+  // displacements as fractions of the larger of phanSize.x and phanSize.z,
+  // covering the phantom from 0 in both directions.  Returns 1 on success.
+  int loadFile(const char* filename, const myVector& phanSize, int legacySize);
+
+  // write the field in the current format, returns 1 on success
+  int saveFile(const char* filename) const;
+
+  // set a 2-D (points[1] == 1) or 3-D field.  v is ignored for a 2-D field.
+  void setGrid(const uint64_t points[3],
+               const double origin[3],
+               const double spacing[3],
+               const std::vector<double>& u,
+               const std::vector<double>& v,
+               const std::vector<double>& w);
+
+  bool threeDimensional() const { return points[1] > 1; }
+
+  // move n scatterers by the field, using threads threads, 0 for one per hardware thread
+  void displace(scatterer* data, int64_t n, int threads) const;
+
+ private:
+  uint64_t points[3];
+  double origin[3];
+  double spacing[3];
+  std::vector<double> u, v, w;
+
+  template <bool threeD>
+  void displaceBlock(scatterer* data, int64_t count) const;
+};
+
+#endif  // COMMON_DISPLACEMENT_H_
@@ -6,18 +6,100 @@
 #include <cmath>
 #include <ctime>
 #include <cassert>
+#include <cstring>
 #include <iostream>
 #include <fstream>
-#include <tr1/random>
-
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "./counterRng.h"
+#include "./displacement.h"
 #include "./memory.h"
+#include "./scattererIndex.h"
+#include "./scattererSort.h"
 
 
-#define Swap(a, b) temp = a; a = b; b = temp;
-
 using std::cout;
 using std::endl;
 
+namespace {
+
+const char phantomMagic[8] = {'U', 'S', 'P', 'H', 'A', 'N', 'T', '\0'};
+const uint32_t phantomVersion = 2;
+const uint32_t endianMark = 0x01020304;
+
+// alignment of the scatterers in a phantom file, at least the page size
+const uint64_t payloadAlignment = 4096;
+
+// number of slabs in the slab index of a phantom file
+const uint64_t defaultSlabCount = 256;
+
+static_assert(sizeof(phantomFileHeader) == 256, "phantom header must be 256 bytes");
+static_assert(sizeof(scatterer) == 3*sizeof(double), "scatterers are written raw");
+
+uint64_t alignUp(uint64_t offset, uint64_t alignment) {
+    return (offset + alignment - 1)/alignment*alignment;
+}
+
+// the expected number of scatterers in one slab of a new phantom, and the
+// largest number of slabs
+const double scatterersPerSlab = 65536;
+const int64_t maxSlabs = 65536;
+
+bool lessX(const scatterer& a, const scatterer& b) {
+    return a.x < b.x;
+}
+
+/*! Draw from a Poisson distribution with mean lambda.  Small means multiply uniform numbers
+ * (Knuth), larger ones use the transformed rejection method PTRS (Hormann 1993).
+ */
+int64_t poisson(double lambda, counterRng* rng) {
+    if (lambda <= 0) return 0;
+
+    if (lambda < 10) {
+        double limit = exp(-lambda);
+        double product = rng->uniform();
+        int64_t k = 0;
+        while (product > limit) {
+            k++;
+            product *= rng->uniform();
+        }
+        return k;
+    }
+
+    double slam = sqrt(lambda);
+    double loglam = log(lambda);
+    double b = 0.931 + 2.53*slam;
+    double a = -0.059 + 0.02483*b;
+    double invalpha = 1.1239 + 1.1328/(b - 3.4);
+    double vr = 0.9277 - 3.6224/(b - 2);
+
+    for (;;) {
+        double U = rng->uniform() - 0.5;
+        double V = rng->uniform();
+        double us = 0.5 - fabs(U);
+        double k = floor((2*a/us + b)*U + lambda + 0.43);
+        if (us >= 0.07 && V <= vr)
+            return static_cast<int64_t>(k);
+        if (k < 0 || (us < 0.013 && V > us))
+            continue;
+        if (log(V) + log(invalpha) - log(a/(us*us) + b) <=
+                                    -lambda + k*loglam - lgamma(k + 1))
+            return static_cast<int64_t>(k);
+    }
+}
+
+}  // namespace
+
 
 phantom::phantom(): c0(0.0),
                     a0(0.0),
@@ -29,6 +111,13 @@ phantom::phantom(): c0(0.0),
                     phanSize.y(0),
                     phanSize.z(0),*/
                     totalScatters(0),
+                    index(new scattererIndex),
+                    mapping(NULL),
+                    mappingSize(0),
+                    streamFile(NULL),
+                    slabStart(NULL),
+                    windowFirst(0),
+                    bufferCapacity(0),
                     bscArray(NULL),
                     bscFreqArray(NULL),
                     numBsc(0),
@@ -37,13 +126,62 @@ phantom::phantom(): c0(0.0),
 
 
 phantom::~phantom() {
-    if (buffer) delete[] buffer;
+    releaseScatterers();
+    delete index;
+    delete streamFile;
+    delete[] slabStart;
+    delete[] bscArray;
+    delete[] bscFreqArray;
+}
+
+/*!Free the scatterers, whether they were allocated or mapped from a file
+ */
+void phantom::releaseScatterers() {
+#ifndef _WIN32
+    if (mapping) {
+        munmap(mapping, mappingSize);
+        mapping = NULL;
+        mappingSize = 0;
+        buffer = NULL;
+    }
+#endif
+    delete[] buffer;
+    buffer = NULL;
+    bufferCapacity = 0;
+    index->clear();
+}
+
+/*!Allocate count backscatter coefficients and their frequencies
+ */
+void phantom::allocateBsc(int64_t count) {
+    delete[] bscArray;
+    delete[] bscFreqArray;
+    numBsc = count;
+    bscArray = new double[numBsc];
+    bscFreqArray = new double[numBsc];
 }
 myVector phantom::getPhanSize() {
     return phanSize;
 }
 
-/*!This function creates a phantom object whose scatterers are uniformly distributed throughout the volume
+/*!True if other has the same size, sound speed and attenuation, so that the same pressure
+ * field can be used to image both.  The scatterers and backscatter coefficients may differ.
+ */
+bool phantom::sameMedium(const phantom& other) const {
+    return phanSize.x == other.phanSize.x &&
+           phanSize.y == other.phanSize.y &&
+           phanSize.z == other.phanSize.z &&
+           c0 == other.c0 &&
+           a0 == other.a0 && a1 == other.a1 && a2 == other.a2;
+}
+
+/*!This function creates a phantom object whose scatterers are uniformly distributed throughout the volume.
+ *
+ * The volume is split into lateral slabs.  Each slab draws a Poisson distributed number of
+ * scatterers and their positions from its own counter-based random stream, keyed by the seed
+ * and the slab number, and sorts them by x.  The slabs are generated in parallel and laid out
+ * one after the other, so the scatterers come out sorted by x and are the same for any
+ * number of threads.
  */
 void phantom::createUniformPhantom(const myVector& phansize,
                                    double density,
@@ -51,32 +189,58 @@ void phantom::createUniformPhantom(const myVector& phansize,
                                    double atten0,
                                    double atten1,
                                    double atten2,
-                                   char* fname ) {
+                                   char* fname,
+                                   uint64_t seed,
+                                   int threads) {
     phantom::c0 = soundSpeed;
     phantom::a0 = atten0;
     phantom::a1 = atten1;
     phantom::a2 = atten2;
-    totalScatters = static_cast<int>(phansize.x*phansize.y*phansize.z*density);
-    cout << "The total number of scatterers is: " << totalScatters <<endl;
     phanSize = phansize;
-    buffer = new scatterer[totalScatters];
-    assert(buffer != NULL);
 
-    /* initialize random seed: */
-    std::tr1::mt19937 eng(time(NULL));  // uniform random integer generatot
-    std::tr1::uniform_real<double> dist;
-    std::tr1::variate_generator<std::tr1::mt19937,
-                                std::tr1::uniform_real<double> >
-                                                          generator(eng, dist);
-
-    for (int i = 0; i < totalScatters; i++) {
-        buffer[i].x = generator()*phansize.x;
-        buffer[i].y = generator()*phansize.y;
-        buffer[i].z = generator()*phansize.z;
+    // The slabs only depend on the phantom, never on the thread count
+    double expected = phansize.x*phansize.y*phansize.z*density;
+    int64_t slabs = static_cast<int64_t>(expected/scatterersPerSlab) + 1;
+    if (slabs > maxSlabs) slabs = maxSlabs;
+    double slabWidth = phansize.x/slabs;
+    double slabMean = expected/slabs;
+
+    // first the number of scatterers in every slab, to know where each slab goes
+    std::vector<int64_t> slabStart(slabs + 1, 0);
+    for (int64_t k = 0; k < slabs; k++) {
+        counterRng countRng(seed, 2*k);
+        slabStart[k+1] = slabStart[k] + poisson(slabMean, &countRng);
+    }
 
+    totalScatters = slabStart[slabs];
+    cout << "The total number of scatterers is: " << totalScatters <<endl;
+    releaseScatterers();
+    buffer = new scatterer[totalScatters];
+    bufferCapacity = totalScatters;
+    assert(buffer != NULL);
 
-        // x coordinate is lateral, y is elevational, z is axial
+    // then the positions, handing out slabs to the threads one at a time
+    std::atomic<int64_t> nextSlab(0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(std::thread([&]() {
+            for (int64_t k = nextSlab++; k < slabs; k = nextSlab++) {
+                counterRng rng(seed, 2*k + 1);
+                scatterer* slab = buffer + slabStart[k];
+                int64_t count = slabStart[k+1] - slabStart[k];
+
+                // x coordinate is lateral, y is elevational, z is axial
+                for (int64_t i = 0; i < count; i++) {
+                    slab[i].x = (k + rng.uniform())*slabWidth;
+                    slab[i].y = rng.uniform()*phansize.y;
+                    slab[i].z = rng.uniform()*phansize.z;
+                }
+                std::sort(slab, slab + count, lessX);
+            }
+        }));
     }
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
 
     readBscFromFile(fname);
 }
@@ -109,12 +273,10 @@ void phantom::readBscFromFile(char* fname) {
     bscFile.read( reinterpret_cast<char*>( &tmp    ), sizeof(double) );
     cout << "The number of backscatter coefficients read will be: "
          << tmp << std::endl;
-    numBsc = static_cast<int>(tmp);
+    allocateBsc(static_cast<int64_t>(tmp));
 
-    bscArray = new double[numBsc];
     bscFile.read( reinterpret_cast<char*>( bscArray ), sizeof(double)*numBsc );
 
-    bscFreqArray = new double[numBsc];
     double tempFreq;
     for (int ind = 0; ind < numBsc; ind++) {
         tempFreq = phantom::freqStep*ind;
@@ -138,7 +300,7 @@ double phantom::giveBsc(double freq) {
     return bscCoeff;
 }
 
-/*!  This function saves the phantom data to a binary file.
+/*!  This function saves the phantom data to a binary file, see phantomFileHeader for the layout.
  */
 int phantom::savePhantom(char *filename) {
     sortScatterer();
@@ -149,77 +311,314 @@ int phantom::savePhantom(char *filename) {
         return -1;
     }
 
-    fpout.write( reinterpret_cast<char*>(&phanSize), sizeof(myVector));
-    fpout.write( reinterpret_cast<char*>(&totalScatters), sizeof(int));
-    fpout.write( reinterpret_cast<char*>(&c0), sizeof(double));
-    fpout.write( reinterpret_cast<char*>(&a0), sizeof(double));
-    fpout.write( reinterpret_cast<char*>(&a1), sizeof(double));
-    fpout.write( reinterpret_cast<char*>(&a2), sizeof(double));
-    fpout.write( reinterpret_cast<char*>(buffer), totalScatters*sizeof(scatterer));
+    phantomFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, phantomMagic, sizeof(phantomMagic));
+    header.version = phantomVersion;
+    header.endian = endianMark;
+    header.headerBytes = sizeof(header);
+    header.totalScatters = totalScatters;
+    header.scattererOffset = alignUp(sizeof(header), payloadAlignment);
+    header.bscOffset = header.scattererOffset + totalScatters*sizeof(scatterer);
+    header.phanSize[0] = phanSize.x;
+    header.phanSize[1] = phanSize.y;
+    header.phanSize[2] = phanSize.z;
+    header.c0 = c0;
+    header.a0 = a0;
+    header.a1 = a1;
+    header.a2 = a2;
+    header.numBsc = numBsc;
+    header.freqStep = freqStep;
+
+    // the slab index, so lateral windows can be found without reading the file
+    std::vector<uint64_t> slabs;
+    if (phanSize.x > 0) {
+        header.slabCount = defaultSlabCount;
+        header.slabWidth = phanSize.x/defaultSlabCount;
+        header.slabIndexOffset = header.bscOffset + 2*numBsc*sizeof(double);
+        slabs.resize(header.slabCount + 1);
+        slabs[0] = 0;
+        for (uint64_t k = 1; k < header.slabCount; k++)
+            slabs[k] = binSearch(k*header.slabWidth);
+        slabs[header.slabCount] = totalScatters;
+    }
+
+    fpout.write( reinterpret_cast<char*>(&header), sizeof(header));
+
+    // pad up to the page aligned scatterers
+    char zero[payloadAlignment];
+    memset(zero, 0, sizeof(zero));
+    fpout.write( zero, header.scattererOffset - sizeof(header));
 
-    fpout.write( reinterpret_cast<char*>(&numBsc), sizeof(int));
-    fpout.write( reinterpret_cast<char*>(&freqStep), sizeof(double));
+    fpout.write( reinterpret_cast<char*>(buffer), totalScatters*sizeof(scatterer));
     fpout.write( reinterpret_cast<char*>(bscArray), numBsc*sizeof(double));
     fpout.write( reinterpret_cast<char*>(bscFreqArray), numBsc*sizeof(double));
+    if (!slabs.empty())
+        fpout.write( reinterpret_cast<char*>(&slabs[0]), slabs.size()*sizeof(uint64_t));
 
     fpout.close();
+    if (!fpout) {
+        cout << "error writing phantom file " << filename << endl;
+        return -1;
+    }
 
     return(1);
 }
 
-    /*!  This function reads in a phantom from a file created by savePhantom
-     */
-    int phantom::loadPhantom(char* filename) {
-    std::ifstream fpin;
-    fpin.open(filename, std::ios::binary);
+/*!  Read everything but the scatterers from a phantom file, and describe where the scatterers
+ * are in header.  Files written before phantomFileHeader existed, with a 32 bit scatterer
+ * count and no alignment, are described by a header with version 0.
+ */
+int phantom::readFileInfo(std::ifstream& fpin, const char* filename,
+                          phantomFileHeader* header) {
+    memset(header, 0, sizeof(*header));
+    fpin.read(reinterpret_cast<char*>(header), sizeof(*header));
+
+    if (memcmp(header->magic, phantomMagic, sizeof(phantomMagic)) != 0) {
+        // a file from before phantomFileHeader existed
+        int count, bscCount;
+        fpin.clear();
+        fpin.seekg(0);
+        fpin.read(reinterpret_cast<char*>(&phanSize), sizeof(myVector) );
+        fpin.read(reinterpret_cast<char*>(&count), sizeof(int) );
+        fpin.read(reinterpret_cast<char*>(&c0), sizeof(double) );
+        fpin.read(reinterpret_cast<char*>(&a0), sizeof(double) );
+        fpin.read(reinterpret_cast<char*>(&a1), sizeof(double) );
+        fpin.read(reinterpret_cast<char*>(&a2), sizeof(double) );
+
+        memset(header, 0, sizeof(*header));
+        header->totalScatters = count;
+        header->scattererOffset = fpin.tellg();
+        fpin.seekg(header->scattererOffset + count*sizeof(scatterer));
+        fpin.read( reinterpret_cast<char*>( &bscCount), sizeof(int) );
+        fpin.read( reinterpret_cast<char*>( &header->freqStep), sizeof(double) );
+        header->numBsc = bscCount;
+        header->bscOffset = fpin.tellg();
+    } else {
+        if (!fpin || header->endian != endianMark) {
+            cout << "Phantom file " << filename
+                 << " is damaged or was written with a different byte order" << endl;
+            return 0;
+        }
+        if (header->version > phantomVersion) {
+            cout << "Phantom file " << filename << " has version " << header->version
+                 << ", this program reads up to version " << phantomVersion << endl;
+            return 0;
+        }
 
-    if ( !fpin.is_open() ) {
-    cout << "Error reading phantom file " << filename << std::endl;
-    return 0;
+        phanSize = myVector(header->phanSize[0], header->phanSize[1], header->phanSize[2]);
+        c0 = header->c0;
+        a0 = header->a0;
+        a1 = header->a1;
+        a2 = header->a2;
     }
 
-    fpin.read(reinterpret_cast<char*>(&phanSize), sizeof(myVector) );
-    fpin.read(reinterpret_cast<char*>(&totalScatters), sizeof(int) );
-    fpin.read(reinterpret_cast<char*>(&c0), sizeof(double) );
-    fpin.read(reinterpret_cast<char*>(&a0), sizeof(double) );
-    fpin.read(reinterpret_cast<char*>(&a1), sizeof(double) );
-    fpin.read(reinterpret_cast<char*>(&a2), sizeof(double) );
-
     std::cout << "The phantom size is: "
               << phanSize.x*1E3 << " mm laterally \n"
               << phanSize.y*1E3 << " mm elevationally\n"
               << phanSize.z*1E3 << " mm axially\n";
 
     std::cout << "The number of scatterers in the phantom is: "
-              << totalScatters << std::endl;
-
-    if (buffer != NULL) delete[] buffer;
-    buffer = new scatterer[totalScatters];
+              << header->totalScatters << std::endl;
 
-    fpin.read(reinterpret_cast<char*>(buffer), sizeof(scatterer)*totalScatters);
-    fpin.read( reinterpret_cast<char*>( &numBsc), sizeof(int) );
-    fpin.read( reinterpret_cast<char*>( &freqStep), sizeof(double) );
+    freqStep = header->freqStep;
     std::cout << "The number of backscatter coefficients stored is equal to: "
-              << numBsc << std::endl;
+              << header->numBsc << std::endl;
+    allocateBsc(header->numBsc);
+    fpin.seekg(header->bscOffset);
+    fpin.read( reinterpret_cast<char*>( bscArray), numBsc*sizeof( double) );
+    fpin.read( reinterpret_cast<char*>( bscFreqArray), numBsc*sizeof( double) );
 
-    if (bscArray != NULL) delete[] bscArray;
-    std::cout << "Allocating the backscatter coefficient array \n";
-    bscArray = new double[numBsc];
+    if (!fpin) {
+        cout << "Phantom file " << filename << " is too short" << endl;
+        return 0;
+    }
+    return 1;
+}
 
-    std::cout << "Reading in the backscatter coefficients" << std::endl;
-    fpin.read( reinterpret_cast<char*>( bscArray), numBsc*sizeof( double) );
+/*!  This function reads in a phantom from a file created by savePhantom.  Where possible the
+ * scatterers are not copied but mapped from the file, privately so that changing them does
+ * not change the file.  Phantoms mapped by several processes share the page cache.
+ */
+int phantom::loadPhantom(char* filename) {
+    std::ifstream fpin;
+    fpin.open(filename, std::ios::binary);
 
-    std::cout << "Creating a backscatter frequency array" << std::endl;
-    if (bscFreqArray != NULL) delete[] bscFreqArray;
-    bscFreqArray = new double[numBsc];
+    if ( !fpin.is_open() ) {
+    cout << "Error reading phantom file " << filename << std::endl;
+    return 0;
+    }
 
-    std::cout << "Reading in the backscatter frequencies" <<std::endl;
-    fpin.read( reinterpret_cast<char*>( bscFreqArray), numBsc*sizeof( double) );
+    phantomFileHeader header;
+    if (!readFileInfo(fpin, filename, &header))
+        return 0;
 
+    totalScatters = header.totalScatters;
+    releaseScatterers();
+    size_t scattererBytes = totalScatters*sizeof(scatterer);
+#ifndef _WIN32
+    // only the page aligned scatterers of the current format can be mapped
+    int fd = header.version > 0 ? open(filename, O_RDONLY) : -1;
+    if (fd >= 0 && totalScatters > 0) {
+        mappingSize = header.scattererOffset + scattererBytes;
+        void* mapped = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE, fd, 0);
+        if (mapped != MAP_FAILED) {
+            mapping = mapped;
+            buffer = reinterpret_cast<scatterer*>(
+                           static_cast<char*>(mapped) + header.scattererOffset);
+        }
+    }
+    if (fd >= 0) close(fd);
+#endif
+    if (!mapping) {
+        buffer = new scatterer[totalScatters];
+        bufferCapacity = totalScatters;
+        fpin.clear();
+        fpin.seekg(header.scattererOffset);
+        fpin.read(reinterpret_cast<char*>(buffer), scattererBytes);
+        if (!fpin) {
+            cout << "Phantom file " << filename << " is too short" << endl;
+            return 0;
+        }
+    }
 
     return 1;
 }
 
+/*!  Open a phantom file without reading its scatterers.  Scatterers are read later, one
+ * lateral window at a time, by loadWindow.  Until then the phantom holds no scatterers.
+ */
+int phantom::openStreaming(char* filename) {
+    delete streamFile;
+    streamFile = new std::ifstream(filename, std::ios::binary);
+    streamName = filename;
+
+    if ( !streamFile->is_open() ) {
+    cout << "Error reading phantom file " << filename << std::endl;
+    return 0;
+    }
+
+    if (!readFileInfo(*streamFile, filename, &streamHeader))
+        return 0;
+
+    delete[] slabStart;
+    slabStart = NULL;
+    if (streamHeader.slabCount > 0) {
+        slabStart = new uint64_t[streamHeader.slabCount + 1];
+        streamFile->seekg(streamHeader.slabIndexOffset);
+        streamFile->read(reinterpret_cast<char*>(slabStart),
+                         (streamHeader.slabCount + 1)*sizeof(uint64_t));
+        if (!*streamFile) {
+            cout << "Phantom file " << filename << " has a damaged slab index" << endl;
+            return 0;
+        }
+    } else {
+        cout << "Phantom file " << filename << " has no slab index, windows are "
+             << "found by searching the file" << endl;
+    }
+
+    releaseScatterers();
+    totalScatters = 0;
+    windowFirst = 0;
+    return 1;
+}
+
+/*!  Read count scatterers of the streamed file, starting at file index first.  Returns 0
+ * if the file is too short or can't be read.
+ */
+int phantom::readScatterers(int64_t first, int64_t count, scatterer* out) {
+    streamFile->clear();
+    streamFile->seekg(streamHeader.scattererOffset + first*sizeof(scatterer));
+    streamFile->read(reinterpret_cast<char*>(out), count*sizeof(scatterer));
+    return *streamFile ? 1 : 0;
+}
+
+/*!  The file index of the first scatterer with an x coordinate of at least x, found by a
+ * binary search over the file within the slab that holds x, or -1 if the file can't be read.
+ */
+int64_t phantom::fileLowerBound(double x) {
+    int64_t left = 0;
+    int64_t right = streamHeader.totalScatters;
+    if (slabStart) {
+        double slab = floor(x/streamHeader.slabWidth);
+        int64_t k = static_cast<int64_t>(std::max(0.0, std::min(slab,
+                                        streamHeader.slabCount - 1.0)));
+        left = slabStart[k];
+        right = slabStart[k+1];
+    }
+
+    while (left < right) {
+        int64_t center = left + (right - left)/2;
+        scatterer s;
+        if (!readScatterers(center, 1, &s))
+            return -1;
+        if (s.x >= x)
+            right = center;
+        else
+            left = center+1;
+    }
+    return left;
+}
+
+/*!  Make the scatterers with xStart <= x < xEnd the resident scatterers of a phantom opened by
+ * openStreaming, and return how many there are.  Scatterers still resident from the previous
+ * window are kept, so sweeping the window in increasing x reads every scatterer once.  If the
+ * file can't be read, e.g. it was truncated after it was opened, no scatterers are left
+ * resident and -1 is returned.
+ */
+int64_t phantom::loadWindow(double xStart, double xEnd) {
+    assert(streamFile != NULL);
+    int64_t first = fileLowerBound(xStart);
+    int64_t last = first < 0 ? -1 : fileLowerBound(xEnd);
+    if (last < 0)
+        return windowError();
+    int64_t end = std::max(first, last);
+    int64_t count = end - first;
+
+    // the part of the new window that is already resident
+    int64_t keepFirst = std::max(first, windowFirst);
+    int64_t keepEnd = std::min(end, windowFirst + totalScatters);
+
+    if (count > bufferCapacity) {
+        scatterer* bigger = new scatterer[count];
+        if (keepFirst < keepEnd)
+            memcpy(bigger + (keepFirst - first), buffer + (keepFirst - windowFirst),
+                   (keepEnd - keepFirst)*sizeof(scatterer));
+        delete[] buffer;
+        buffer = bigger;
+        bufferCapacity = count;
+    } else if (keepFirst < keepEnd) {
+        memmove(buffer + (keepFirst - first), buffer + (keepFirst - windowFirst),
+                (keepEnd - keepFirst)*sizeof(scatterer));
+    }
+
+    int read;
+    if (keepFirst < keepEnd) {
+        read = readScatterers(first, keepFirst - first, buffer) &&
+               readScatterers(keepEnd, end - keepEnd, buffer + (keepEnd - first));
+    } else {
+        read = readScatterers(first, count, buffer);
+    }
+    if (!read)
+        return windowError();
+
+    windowFirst = first;
+    totalScatters = count;
+    index->clear();
+    return count;
+}
+
+/*!  Report a streamed phantom file that can't be read and leave no scatterers resident
+ */
+int64_t phantom::windowError() {
+    cout << "Phantom file " << streamName << " is too short or can't be read" << endl;
+    windowFirst = 0;
+    totalScatters = 0;
+    index->clear();
+    return -1;
+}
+
 
 /*!  This function uses a file containing axial and lateral displacements to move each scatterer contained
  * in a phantom.
@@ -236,10 +635,10 @@ void phantom::displaceAnsys(double* u, double* v, int nSize) {
     // same number of points in x and z direction
     (phanSize.x > phanSize.z) ? phsize = phanSize.x:phsize = phanSize.z;
     double spacing = (nSize-1)/phsize;
-    int i, roundX, roundZ, arrayIdx;
+    int roundX, roundZ, arrayIdx;
 
 
-    for (i = 0; i < totalScatters; i++) {
+    for (int64_t i = 0; i < totalScatters; i++) {
         // important to remember coordinates go from 0 to size
         // get x and z for current scatterer in units of points
         x = buffer[i].x*spacing;
@@ -278,27 +677,48 @@ void phantom::displaceAnsys(double* u, double* v, int nSize) {
         buffer[i].x += dispx*phsize;
         buffer[i].z += dispz*phsize;
     }
+    index->clear();
+}
+
+/*!  Move every scatterer by a displacement field, see displacementField::displace.  The
+ * scatterers have to be sorted again afterwards.
+ */
+void phantom::displace(const displacementField& field, int threads) {
+    field.displace(buffer, totalScatters, threads);
+    index->clear();
 }
 
 /*!  This function gets scatterers located between two X coordinates.  It depends on the scatterers
  * contained in a phantom's scatterer array to be sorted by increasing x coordinate
  */
-int phantom::getScattersBetween(double start, double end, scatterer** buf) {
+int64_t phantom::getScattersBetween(double start, double end, scatterer** buf) {
     assert(start < end);
-    int recStart = binSearch(start);
-    int recEnd = binSearch(end);
-    int recLen = recEnd - recStart;
+    int64_t recStart = binSearch(start);
+    int64_t recEnd = binSearch(end);
+    int64_t recLen = recEnd - recStart;
     *buf    = &buffer[recStart];
     return recLen;
 }
 
+/*!  Get the scatterers inside a box, see scattererIndex.  Like getScattersBetween this needs
+ * the scatterers sorted by increasing x coordinate.
+ */
+int64_t phantom::getScattersInBox(const myVector& lower, const myVector& upper,
+                                  std::vector<int64_t>* found) {
+    if (!index->built())
+        index->build(buffer, totalScatters);
+    return index->query(buffer, lower, upper, found);
+}
+
 /*!  This function is a standard binary search.
  */
-int phantom::binSearch(double val) {
+int64_t phantom::binSearch(double val) {
     // finds the scatterer with the closest x coordinate to val
-    int left = 0;
-    int right = totalScatters-1;
-    int center;
+    int64_t left = 0;
+    int64_t right = totalScatters-1;
+    int64_t center;
+    if (totalScatters == 0)
+        return 0;
     if (buffer[0].x >= val)
         return 0;
     if (buffer[totalScatters-1].x < val)
@@ -328,48 +748,10 @@ double phantom::attenuation(double freq) {
     return db*100.*log(10)/20;
 }
 
-/*!  Sort scatterers by increasing x coordinate using a quicksort algorithm
+/*!  Sort scatterers by increasing x coordinate, see sortScatterers.  Already sorted
+ * scatterers are left untouched, so a phantom mapped from a file stays shared with the file.
  */
 void phantom::sortScatterer() {
-    quickSort(buffer, 0, totalScatters-1);
-}
-
-/*!  A standard quick sort
- */
-void phantom::quickSort(scatterer *A, int F, int L) {
-    int PivotIndex;
-    if (F < L) {
-        if (F == (L-1)) {
-            if (A[F].x > A[L].x) {
-                scatterer temp;
-                Swap(A[F], A[L]);
-            }
-            return;
-        }
-        partition(A, F, L, &PivotIndex);
-        quickSort(A, F, PivotIndex-1);
-        quickSort(A, PivotIndex+1, L);
-    }
-}
-
-/*!  A component of the quicksort algorithm
- */
-void phantom::partition(scatterer* A, int F, int L, int* PivotIndex) {
-    int pivotind = static_cast<int>( (F+L)/2);
-    scatterer temp;
-    Swap(A[F], A[pivotind]);
-    scatterer Pivot = A[F];
-    int LastS1 = F;
-    int FirstUnknown = F+1;
-
-    for (; FirstUnknown <= L; ++FirstUnknown) {
-        if ( A[FirstUnknown].x < Pivot.x ) {
-            ++LastS1;
-            Swap(A[FirstUnknown], A[LastS1]);
-        }
-    }
-
-    Swap(A[F], A[LastS1]);
-
-    *PivotIndex = LastS1;
+    sortScatterers(buffer, totalScatters);
+    index->clear();
 }
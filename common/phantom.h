@@ -1,6 +1,16 @@
 #ifndef COMMON_PHANTOM_H_
 #define COMMON_PHANTOM_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+class displacementField;
+class scattererIndex;
+
 /*! \brief A structure that holds the x,y,z position of a scatterer.  More info to be added.
  */
 struct scatterer {
@@ -19,6 +29,38 @@ struct myVector {
        myVector(double X, double Y, double Z) : x(X), y(Y), z(Z) {}
 };
 
+/*! \brief The header of a phantom file.
+ *
+ * Phantom files start with this header, followed by the scatterers at scattererOffset, which is
+ * a multiple of the page size so the scatterers can be used straight from a memory mapping of
+ * the file, and then the backscatter coefficients and their frequencies at bscOffset.
+ * All counts are 64 bit.  Files written before this header existed start directly with the
+ * phantom size and are still read by loadPhantom.
+ *
+ * The scatterers are sorted by x.  From version 2 the file also holds a slab index at
+ * slabIndexOffset: slabCount+1 scatterer indices, entry k being the first scatterer with
+ * x >= k*slabWidth.  The first slab also holds any scatterers with x < 0 and the last any past
+ * the end of the phantom.  With it a lateral window of the phantom is found without reading
+ * the rest, see openStreaming.
+ */
+struct phantomFileHeader {
+    char magic[8];             // "USPHANT" and a terminating zero
+    uint32_t version;
+    uint32_t endian;           // 0x01020304 as written by the machine that wrote it
+    uint64_t headerBytes;      // sizeof(phantomFileHeader)
+    uint64_t totalScatters;
+    uint64_t scattererOffset;  // byte offset of the scatterers
+    uint64_t bscOffset;        // byte offset of the backscatter coefficients
+    double phanSize[3];        // x, y, z
+    double c0, a0, a1, a2;
+    uint64_t numBsc;
+    double freqStep;           // backscatter coefficient spacing in MHz
+    uint64_t slabCount;        // version 2, zero if there is no slab index
+    double slabWidth;
+    uint64_t slabIndexOffset;
+    char reserved[112];        // zero, room for later versions
+};
+
 /*! \brief This class encompasses the attenuation, sound speed, and backscatter coefficients of an object to be imaged.
   */
 class phantom {
@@ -32,21 +74,42 @@ class phantom {
                             double atten0,
                             double atten1,
                             double atten2,
-                            char* fname);
+                            char* fname,
+                            uint64_t seed,
+                            int threads);
 
   // saving and loading phantoms for future use
   int savePhantom(char* filename);
   int loadPhantom(char* filename);
+  int64_t scattererCount() { return totalScatters; }
+
+  // keeping only a lateral window of a phantom file in memory, for phantoms
+  // larger than RAM.  After loadWindow the phantom holds only the scatterers
+  // with xStart <= x < xEnd, and all other functions work on those.  It
+  // returns -1 if the file can't be read.
+  int openStreaming(char* filename);
+  int64_t loadWindow(double xStart, double xEnd);
 
   // displacing the scatterer positions. Used for compressions and elastography.
+  // displaceAnsys is the original square 2-D grid interpolation, displace
+  // takes any displacementField.
   void displaceAnsys(double* u, double* v, int nSize);
+  void displace(const displacementField& field, int threads);
 
   // finding scatterers
-  int getScattersBetween(double start, double end, scatterer** buf);
-  int binSearch(double val);
+  int64_t getScattersBetween(double start, double end, scatterer** buf);
+  int64_t binSearch(double val);
+
+  // finding the scatterers with lower <= position < upper through a bucket
+  // index, which is built on first use after the scatterers change.  Their
+  // indices are appended to found in increasing order.
+  int64_t getScattersInBox(const myVector& lower, const myVector& upper,
+                           std::vector<int64_t>* found);
+  const scatterer& getScatterer(int64_t i) { return buffer[i]; }
 
   // functions for getting info about the phantoms
   myVector getPhanSize();
+  bool sameMedium(const phantom& other) const;
 
   // return sound speed or attenuation as a function of frequency
   double soundSpeed();
@@ -54,8 +117,6 @@ class phantom {
 
   // sorting scatterers
   void sortScatterer();
-  void quickSort(scatterer *A, int F, int L);
-  void partition(scatterer* A, int F, int L, int* PivotIndex);
 
   // obtaining backscatter coefficient
   double giveBsc(double freq);
@@ -65,16 +126,36 @@ class phantom {
   double a0, a1, a2;  // Frequency dependent attenuation
   scatterer* buffer;
   myVector phanSize;
-  int totalScatters;
+  int64_t totalScatters;
+  scattererIndex* index;
+
+  // set when buffer points into a memory mapping of the phantom file
+  void* mapping;
+  size_t mappingSize;
+  void releaseScatterers();
+  int readFileInfo(std::ifstream& fpin, const char* filename,
+                   phantomFileHeader* header);
+
+  // streaming state, see openStreaming
+  std::ifstream* streamFile;
+  std::string streamName;
+  phantomFileHeader streamHeader;
+  uint64_t* slabStart;
+  int64_t windowFirst;     // file index of buffer[0]
+  int64_t bufferCapacity;  // scatterers allocated in buffer
+  int64_t fileLowerBound(double x);
+  int readScatterers(int64_t first, int64_t count, scatterer* out);
+  int64_t windowError();
 
   // function for calculating backscatter coefficients eventually,
   // for now just reads in a list
   void readBscFromFile(char* filename);
 
   // info about backscatter coefficients
+  void allocateBsc(int64_t count);
   double* bscArray;
   double* bscFreqArray;
-  int numBsc;
+  int64_t numBsc;
   double freqStep;
 };
 
@@ -0,0 +1,175 @@
+#include "./scattererIndex.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+// average number of scatterers per cell
+const int64_t cellScatterers = 64;
+
+// most cells along any one direction
+const int maxBins = 1024;
+
+}  // namespace
+
+scattererIndex::scattererIndex(): indexed(false), total(0) {
+    for (int d = 0; d < 3; d++) {
+        bins[d] = 1;
+        lowest[d] = highest[d] = 0;
+        binWidth[d] = 1;
+    }
+}
+
+void scattererIndex::clear() {
+    indexed = false;
+    total = 0;
+    slabStart.clear();
+    cellStart.clear();
+    entries.clear();
+}
+
+/*!  The cell along direction dim holding coordinate v.  Coordinates outside the bounding box,
+ * which only rounding can give, go to the cell at the edge.
+ */
+int scattererIndex::binOf(int dim, double v) const {
+    double b = floor((v - lowest[dim])/binWidth[dim]);
+    if (b < 0) return 0;
+    if (b >= bins[dim]) return bins[dim] - 1;
+    return static_cast<int>(b);
+}
+
+/*!  Index the n scatterers at data.  The cells are close to cubes, sized from the bounding box
+ * of the scatterers so that a cell holds about cellScatterers of them on average.
+ */
+void scattererIndex::build(const scatterer* data, int64_t n) {
+    clear();
+    total = n;
+    indexed = true;
+    if (n == 0) {
+        slabStart.assign(2, 0);
+        cellStart.assign(2, 0);
+        return;
+    }
+
+    for (int d = 0; d < 3; d++)
+        lowest[d] = highest[d] = (&data[0].x)[d];
+    for (int64_t i = 1; i < n; i++) {
+        const double* p = &data[i].x;
+        for (int d = 0; d < 3; d++) {
+            lowest[d] = std::min(lowest[d], p[d]);
+            highest[d] = std::max(highest[d], p[d]);
+        }
+    }
+
+    // side of a cube holding cellScatterers scatterers, over the directions
+    // in which the scatterers are spread out at all
+    double volume = 1;
+    int spread = 0;
+    for (int d = 0; d < 3; d++) {
+        if (highest[d] > lowest[d]) {
+            volume *= highest[d] - lowest[d];
+            spread++;
+        }
+    }
+    double cells = std::max<double>(1, static_cast<double>(n)/cellScatterers);
+    double side = spread ? pow(volume/cells, 1./spread) : 1;
+
+    for (int d = 0; d < 3; d++) {
+        double extent = highest[d] - lowest[d];
+        bins[d] = 1;
+        if (extent > 0)
+            bins[d] = static_cast<int>(std::min<double>(maxBins,
+                                          std::max(1., ceil(extent/side))));
+        binWidth[d] = extent > 0 ? extent/bins[d] : 1;
+    }
+
+    // the scatterers are sorted by x, so every slab is a contiguous range
+    slabStart.assign(bins[0] + 1, n);
+    int slab = 0;
+    slabStart[0] = 0;
+    for (int64_t i = 0; i < n; i++) {
+        int b = binOf(0, data[i].x);
+        while (slab < b) slabStart[++slab] = i;
+    }
+    for (int b = 0; b < bins[0]; b++)
+        assert(slabStart[b+1] - slabStart[b] <= static_cast<int64_t>(UINT32_MAX));
+
+    // counting sort of the scatterers into cells, which keeps each cell in increasing order
+    int64_t planeCells = static_cast<int64_t>(bins[1])*bins[2];
+    cellStart.assign(bins[0]*planeCells + 1, 0);
+    auto cellOf = [&](int64_t i) {
+        return binOf(0, data[i].x)*planeCells
+               + static_cast<int64_t>(binOf(1, data[i].y))*bins[2]
+               + binOf(2, data[i].z);
+    };
+    for (int64_t i = 0; i < n; i++)
+        cellStart[cellOf(i) + 1]++;
+    for (size_t c = 1; c < cellStart.size(); c++)
+        cellStart[c] += cellStart[c-1];
+
+    entries.resize(n);
+    std::vector<int64_t> next(cellStart.begin(), cellStart.end() - 1);
+    for (int64_t i = 0; i < n; i++) {
+        int64_t cell = cellOf(i);
+        entries[next[cell]++] = static_cast<uint32_t>(i - slabStart[cell/planeCells]);
+    }
+}
+
+/*!  Find the scatterers in the box lower <= position < upper.  When the box holds the whole
+ * bounding box in y and z this is a binary search on x.  Otherwise only the cells the box
+ * touches are read, and their scatterers tested against the box.
+ */
+int64_t scattererIndex::query(const scatterer* data,
+                              const myVector& lower,
+                              const myVector& upper,
+                              std::vector<int64_t>* found) const {
+    assert(indexed);
+    size_t first = found->size();
+    if (total == 0) return 0;
+
+    const double lo[3] = {lower.x, lower.y, lower.z};
+    const double hi[3] = {upper.x, upper.y, upper.z};
+    for (int d = 0; d < 3; d++)
+        if (!(lo[d] < hi[d]) || hi[d] <= lowest[d] || lo[d] > highest[d])
+            return 0;
+
+    if (lo[1] <= lowest[1] && hi[1] > highest[1] &&
+        lo[2] <= lowest[2] && hi[2] > highest[2]) {
+        const scatterer* begin = std::lower_bound(data, data + total, lo[0],
+                  [](const scatterer& s, double v) { return s.x < v; });
+        const scatterer* end = std::lower_bound(begin, data + total, hi[0],
+                  [](const scatterer& s, double v) { return s.x < v; });
+        for (const scatterer* s = begin; s < end; s++)
+            found->push_back(s - data);
+        return end - begin;
+    }
+
+    int firstBin[3], lastBin[3];
+    for (int d = 0; d < 3; d++) {
+        firstBin[d] = binOf(d, lo[d]);
+        lastBin[d] = binOf(d, hi[d]);
+    }
+
+    int64_t planeCells = static_cast<int64_t>(bins[1])*bins[2];
+    for (int bx = firstBin[0]; bx <= lastBin[0]; bx++) {
+        size_t slabFound = found->size();
+        int64_t slabFirst = slabStart[bx];
+        for (int by = firstBin[1]; by <= lastBin[1]; by++) {
+            int64_t cell = bx*planeCells + static_cast<int64_t>(by)*bins[2];
+            for (int64_t e = cellStart[cell + firstBin[2]];
+                 e < cellStart[cell + lastBin[2] + 1]; e++) {
+                int64_t i = slabFirst + entries[e];
+                const scatterer& s = data[i];
+                if (s.x >= lo[0] && s.x < hi[0] && s.y >= lo[1] && s.y < hi[1] &&
+                    s.z >= lo[2] && s.z < hi[2])
+                    found->push_back(i);
+            }
+        }
+
+        // cells are each in increasing order, the slab as a whole is not
+        std::sort(found->begin() + slabFound, found->end());
+    }
+    return found->size() - first;
+}
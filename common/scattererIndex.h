@@ -0,0 +1,49 @@
+#ifndef COMMON_SCATTERERINDEX_H_
+#define COMMON_SCATTERERINDEX_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "./phantom.h"
+
+/*! \brief A bucket index over scatterers sorted by x, for finding the scatterers in a box.
+ *
+ * The bounding box of the scatterers is split into lateral x elevational x axial cells of
+ * roughly cellScatterers scatterers each.  Because the scatterers are sorted by x, each
+ * lateral slab of cells is a contiguous range of them; within a slab every cell lists the
+ * offsets of its scatterers from the start of the slab.  The index holds 4 bytes per
+ * scatterer plus 8 per cell, and has to be rebuilt whenever the scatterers change.
+ */
+class scattererIndex {
+ public:
+  scattererIndex();
+
+  // index the n scatterers at data, which must be sorted by x
+  void build(const scatterer* data, int64_t n);
+  void clear();
+  bool built() const { return indexed; }
+
+  // append the indices of the scatterers with lower <= position < upper to found,
+  // in increasing order, and return how many were appended
+  int64_t query(const scatterer* data,
+                const myVector& lower,
+                const myVector& upper,
+                std::vector<int64_t>* found) const;
+
+ private:
+  bool indexed;
+  int64_t total;
+  int bins[3];            // cells along x, y and z
+  double lowest[3];       // bounding box of the scatterers
+  double highest[3];
+  double binWidth[3];
+
+  std::vector<int64_t> slabStart;  // first scatterer of each lateral slab, plus the total
+  std::vector<int64_t> cellStart;  // first entry of each cell, plus the total
+  std::vector<uint32_t> entries;   // scatterer offsets from the start of their slab
+
+  int binOf(int dim, double v) const;
+};
+
+#endif  // COMMON_SCATTERERINDEX_H_
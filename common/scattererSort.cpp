@@ -0,0 +1,257 @@
+#include "./scattererSort.h"
+
+#include <string.h>
+
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// bits sorted per radix pass, 3 passes cover the 33 bit key
+const int radixBits = 11;
+const int radixBuckets = 1 << radixBits;
+const int radixPasses = 3;
+const double keyRange = 8589934592.0;  // 2^33
+
+// runs shorter than this are extended by insertion sort before merging
+const int64_t minRun = 32;
+
+// block length used to estimate how far scatterers are out of place
+const int64_t sampleBlock = 256;
+
+// below this size everything is done on the calling thread
+const int64_t parallelThreshold = 1 << 16;
+
+/*! \brief Maps x to a 33 bit radix key.  The map never decreases, so sorting by key sorts by x
+ * apart from the rare scatterers that share a key, which are put in order afterwards.
+ */
+struct sortKey {
+    double lowest, scale;
+
+    sortKey(double low, double high)
+        : lowest(low), scale(keyRange*(1 - 1e-9)/(high - low)) {}
+
+    uint64_t operator()(double x) const {
+        return static_cast<uint64_t>((x - lowest)*scale);
+    }
+};
+
+/*! Run body(t) for t = 0 .. threads-1, each on its own thread
+ */
+template <typename Body>
+void parallelFor(int threads, Body body) {
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(body, t));
+    body(0);
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+int threadsFor(int64_t n, int threads) {
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    if (n < parallelThreshold) threads = 1;
+    return threads;
+}
+
+/*! Merge the sorted ranges [lo, mid) and [mid, hi).  Only the part where the two ranges
+ * overlap is moved, so merging runs that barely overlap, as in nearly sorted data, is cheap.
+ */
+void mergeRuns(scatterer* data, int64_t lo, int64_t mid, int64_t hi,
+               std::vector<scatterer>* tmp) {
+    if (lo >= mid || mid >= hi || data[mid-1].x <= data[mid].x) return;
+
+    // left elements not above the first right element are already in place,
+    // as are right elements not below the last left element
+    double firstRight = data[mid].x;
+    double lastLeft = data[mid-1].x;
+    lo = std::upper_bound(data + lo, data + mid, firstRight,
+             [](double v, const scatterer& s) { return v < s.x; }) - data;
+    hi = std::lower_bound(data + mid, data + hi, lastLeft,
+             [](const scatterer& s, double v) { return s.x < v; }) - data;
+
+    tmp->assign(data + lo, data + mid);
+    const scatterer* left = tmp->data();
+    const scatterer* leftEnd = left + tmp->size();
+    int64_t right = mid;
+    int64_t out = lo;
+
+    // taking the left element on ties keeps the merge stable
+    while (left < leftEnd && right < hi) {
+        if (data[right].x < left->x)
+            data[out++] = data[right++];
+        else
+            data[out++] = *left++;
+    }
+    while (left < leftEnd)
+        data[out++] = *left++;
+}
+
+/*! Split [lo, hi) into ascending runs, reversing strictly descending ones and extending short
+ * ones to minRun by binary insertion sort.  The start of every run is appended to starts.
+ */
+void findRuns(scatterer* data, int64_t lo, int64_t hi, std::vector<int64_t>* starts) {
+    int64_t i = lo;
+    while (i < hi) {
+        int64_t j = i + 1;
+        if (j < hi && data[j].x < data[i].x) {
+            while (j < hi && data[j].x < data[j-1].x) j++;
+            std::reverse(data + i, data + j);
+        } else {
+            while (j < hi && data[j].x >= data[j-1].x) j++;
+        }
+
+        int64_t end = std::min(hi, i + minRun);
+        for (; j < end; j++) {
+            scatterer s = data[j];
+            scatterer* pos = std::upper_bound(data + i, data + j, s.x,
+                              [](double v, const scatterer& t) { return v < t.x; });
+            memmove(pos + 1, pos, (data + j - pos)*sizeof(scatterer));
+            *pos = s;
+        }
+
+        starts->push_back(i);
+        i = j;
+    }
+}
+
+}  // namespace
+
+/*!  Sort by increasing x, choosing the algorithm from how far scatterers are out of place.  Sorted
+ * input is not written to, so a phantom mapped from a file stays shared with the file.
+ */
+void sortScatterers(scatterer* data, int64_t n, int threads) {
+    int64_t descents = 0;
+    for (int64_t i = 1; i < n; i++)
+        if (data[i].x < data[i-1].x) descents++;
+    if (descents == 0) return;
+
+    // Merging is cheap when scatterers only moved past close neighbours, however many runs
+    // that makes.  Estimate how much a merge would move: for every block, the length of its
+    // head that is below the largest x of the block before.
+    int64_t misplaced = 0;
+    double previousMax = -HUGE_VAL;
+    for (int64_t start = 0; start < n; start += sampleBlock) {
+        int64_t end = std::min(n, start + sampleBlock);
+        int64_t head = 0;
+        double blockMax = data[start].x;
+        for (int64_t i = start; i < end; i++) {
+            if (data[i].x < previousMax) head = i - start + 1;
+            blockMax = std::max(blockMax, data[i].x);
+        }
+        misplaced += head;
+        previousMax = blockMax;
+    }
+
+    // merging costs about log2(runs) passes over the misplaced part, radix sorting about four
+    // passes over everything
+    if (misplaced < n/4)
+        mergeSortScattererRuns(data, n, threads);
+    else
+        radixSortScatterers(data, n, threads);
+}
+
+/*!  A stable LSD radix sort on a 33 bit key scaled from the x coordinate.  Each thread counts
+ * and then scatters its own contiguous part of the input, so the order of equal keys is kept.
+ * Passes over digits that are the same for every scatterer are skipped.  Scatterers sharing a
+ * key are sorted by a final merge pass, which only has to fix those.
+ */
+void radixSortScatterers(scatterer* data, int64_t n, int threads) {
+    if (n < 2) return;
+    threads = threadsFor(n, threads);
+
+    double low = data[0].x, high = data[0].x;
+    for (int64_t i = 1; i < n; i++) {
+        low = std::min(low, data[i].x);
+        high = std::max(high, data[i].x);
+    }
+    if (!(high > low) || !std::isfinite(high - low)) {
+        // all equal, or not finite numbers that cannot be scaled
+        std::stable_sort(data, data + n,
+                         [](const scatterer& a, const scatterer& b) { return a.x < b.x; });
+        return;
+    }
+    const sortKey key(low, high);
+
+    std::vector<scatterer> buffer(n);
+    scatterer* src = data;
+    scatterer* dst = buffer.data();
+
+    std::vector<int64_t> chunkStart(threads + 1);
+    for (int t = 0; t <= threads; t++)
+        chunkStart[t] = n*t/threads;
+
+    std::vector<int64_t> counts(static_cast<size_t>(threads)*radixBuckets);
+
+    for (int pass = 0; pass < radixPasses; pass++) {
+        int shift = pass*radixBits;
+
+        std::fill(counts.begin(), counts.end(), 0);
+        parallelFor(threads, [&](int t) {
+            int64_t* count = &counts[static_cast<size_t>(t)*radixBuckets];
+            for (int64_t i = chunkStart[t]; i < chunkStart[t+1]; i++)
+                count[(key(src[i].x) >> shift) & (radixBuckets - 1)]++;
+        });
+
+        // turn the counts into write positions: by digit, then by thread
+        int64_t position = 0;
+        bool allSame = false;
+        for (int d = 0; d < radixBuckets; d++) {
+            int64_t digitStart = position;
+            for (int t = 0; t < threads; t++) {
+                int64_t c = counts[static_cast<size_t>(t)*radixBuckets + d];
+                counts[static_cast<size_t>(t)*radixBuckets + d] = position;
+                position += c;
+            }
+            if (position - digitStart == n) allSame = true;
+        }
+        if (allSame) continue;
+
+        parallelFor(threads, [&](int t) {
+            int64_t* next = &counts[static_cast<size_t>(t)*radixBuckets];
+            for (int64_t i = chunkStart[t]; i < chunkStart[t+1]; i++)
+                dst[next[(key(src[i].x) >> shift) & (radixBuckets - 1)]++] = src[i];
+        });
+        std::swap(src, dst);
+    }
+
+    if (src != data)
+        memcpy(data, src, n*sizeof(scatterer));
+
+    mergeSortScattererRuns(data, n, threads);
+}
+
+/*!  A stable natural merge sort.  The input is split into ascending runs, which are merged in
+ * pairs, level by level, with the merges of a level shared out over the threads.  Merging only
+ * moves the overlapping part of two runs, so nearly sorted input costs little more than
+ * finding its runs.
+ */
+void mergeSortScattererRuns(scatterer* data, int64_t n, int threads) {
+    if (n < 2) return;
+    threads = threadsFor(n, threads);
+
+    std::vector<int64_t> starts;
+    findRuns(data, 0, n, &starts);
+    starts.push_back(n);
+
+    while (starts.size() > 2) {
+        int64_t pairs = (starts.size() - 1)/2;
+        std::atomic<int64_t> nextPair(0);
+        parallelFor(static_cast<int>(std::min<int64_t>(threads, pairs)), [&](int) {
+            std::vector<scatterer> tmp;
+            for (int64_t p = nextPair++; p < pairs; p = nextPair++)
+                mergeRuns(data, starts[2*p], starts[2*p+1], starts[2*p+2], &tmp);
+        });
+
+        // every other boundary is gone, an unpaired last run carries over
+        std::vector<int64_t> merged;
+        for (size_t i = 0; i < starts.size(); i += 2)
+            merged.push_back(starts[i]);
+        if (merged.back() != n) merged.push_back(n);
+        starts.swap(merged);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef COMMON_SCATTERERSORT_H_
+#define COMMON_SCATTERERSORT_H_
+
+#include <stdint.h>
+
+#include "./phantom.h"
+
+/*! \brief Sorting scatterers by increasing x coordinate.
+ *
+ * The input is scanned for ascending runs first.  Sorted input is left untouched, nearly
+ * sorted input, such as a displaced phantom, is sorted by merging its runs, and anything else
+ * by an LSD radix sort on the x coordinate.  Both sorts are stable and split their work over
+ * threads, and the result does not depend on the thread count.
+ */
+
+// sort n scatterers using up to threads threads, 0 means one per hardware thread
+void sortScatterers(scatterer* data, int64_t n, int threads = 0);
+
+// the two sorts, also usable on their own
+void radixSortScatterers(scatterer* data, int64_t n, int threads);
+void mergeSortScattererRuns(scatterer* data, int64_t n, int threads);
+
+#endif  // COMMON_SCATTERERSORT_H_
@@ -0,0 +1,92 @@
+#include "./settings.h"
+
+#include <stdlib.h>
+
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+std::string trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r\n");
+    if (first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(" \t\r\n");
+    return s.substr(first, last - first + 1);
+}
+
+}  // namespace
+
+optionalSettings::optionalSettings() {}
+
+/*!  Read every remaining line of the input file.  Lines without a ':' are ignored, so blank lines
+ * and comments are allowed between entries.
+ */
+void optionalSettings::readRemaining(FILE* fp) {
+    std::string line;
+    int c;
+    do {
+        c = fgetc(fp);
+        if (c != '\n' && c != EOF) {
+            line += static_cast<char>(c);
+            continue;
+        }
+
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string label = trim(line.substr(0, colon));
+            entries[label] = trim(line.substr(colon + 1));
+            used[label] = false;
+        }
+        line.clear();
+    } while (c != EOF);
+}
+
+bool optionalSettings::has(const char* label) const {
+    std::map<std::string, std::string>::const_iterator it = entries.find(label);
+    if (it == entries.end()) return false;
+    used[label] = true;
+    return true;
+}
+
+double optionalSettings::getDouble(const char* label, double fallback) const {
+    if (!has(label)) return fallback;
+    const std::string& text = entries.find(label)->second;
+    char* end;
+    double value = strtod(text.c_str(), &end);
+    if (end == text.c_str()) {
+        cout << "Error! Setting '" << label << "' expects a number, got: "
+             << text << endl;
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+int optionalSettings::getInt(const char* label, int fallback) const {
+    if (!has(label)) return fallback;
+    const std::string& text = entries.find(label)->second;
+    char* end;
+    long value = strtol(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        cout << "Error! Setting '" << label << "' expects an integer, got: "
+             << text << endl;
+        exit(EXIT_FAILURE);
+    }
+    return static_cast<int>(value);
+}
+
+std::string optionalSettings::getString(const char* label,
+                                        const std::string& fallback) const {
+    if (!has(label)) return fallback;
+    return entries.find(label)->second;
+}
+
+void optionalSettings::warnUnused() const {
+    std::map<std::string, bool>::const_iterator it;
+    for (it = used.begin(); it != used.end(); ++it) {
+        if (!it->second)
+            cout << "Warning: unknown setting '" << it->first
+                 << "' is ignored" << endl;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef COMMON_SETTINGS_H_
+#define COMMON_SETTINGS_H_
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+
+/*! \brief Optional "label:value" entries that may follow the required entries of an input file.
+ *
+ * The required entries of every input file are read in a fixed order.  Anything after them is
+ * read by this class as one entry per line, so new settings can be added without breaking old
+ * input files.  Labels are matched exactly, ignoring surrounding whitespace.
+ */
+class optionalSettings {
+ public:
+  optionalSettings();
+
+  // read every remaining line of an already opened input file
+  void readRemaining(FILE* fp);
+
+  bool has(const char* label) const;
+  double getDouble(const char* label, double fallback) const;
+  int getInt(const char* label, int fallback) const;
+  std::string getString(const char* label, const std::string& fallback) const;
+
+  // print a warning for each entry that was never asked for
+  void warnUnused() const;
+
+ private:
+  std::map<std::string, std::string> entries;
+  mutable std::map<std::string, bool> used;
+};
+
+#endif  // COMMON_SETTINGS_H_
@@ -1,3 +1,3 @@
-g++ common/phantom.cpp create/createphantom.cpp -I common -I create -o createPhantom
-g++ common/phantom.cpp compress/*.cpp -I common -I compress -o compressPhantom
-g++ common/phantom.cpp rfData/*.cpp -I common -I rfData -O3 -o rfDataProgram
+g++ common/*.cpp create/createphantom.cpp -I common -I create -std=c++11 -pthread -o createPhantom
+g++ common/*.cpp compress/*.cpp -I common -I compress -std=c++11 -pthread -o compressPhantom
+g++ common/*.cpp rfData/*.cpp -I common -I rfData -O3 -std=c++11 -pthread -o rfDataProgram
@@ -1,19 +1,44 @@
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
 
+#include "./displacement.h"
 #include "./phantom.h"
+#include "./settings.h"
 
 using std::cout;
 using std::endl;
 
+/*!  The file name of frame (frame) of (frames): the output name itself for a single frame,
+ * otherwise the output name with _<frame> put before its extension, as in post_03.dat.
+ */
+std::string frameFileName(const char* outName, int frame, int frames) {
+    if (frames == 1) return outName;
+
+    std::string name(outName);
+    size_t dot = name.find_last_of('.');
+    size_t slash = name.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = name.size();
+
+    int width = 1;
+    for (int f = frames; f >= 10; f /= 10) width++;
+    char number[32];
+    snprintf(number, sizeof(number), "_%0*d", width, frame);
+    return name.substr(0, dot) + number + name.substr(dot);
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         cout << "Error! An input file is needed " << endl;
         return -1;
     }
-    char inphanfile[60], outphanfile[60], displfile[60];
+    char inphanfile[60], outphanfile[60], displfiles[1024];
     int dispSize;
     int success;
 
@@ -33,45 +58,58 @@ int main(int argc, char* argv[]) {
     assert(success == 1);
 
     while (fgetc(fpinput) != ':') {}
-    success = fscanf(fpinput, "%s", displfile);
+    success = fscanf(fpinput, "%1023s", displfiles);
     assert(success == 1);
 
     while (fgetc(fpinput) != ':') {}
     success = fscanf(fpinput, "%d", &dispSize);
     assert(success == 1);
 
+    // 0 threads means one per hardware thread
+    optionalSettings options;
+    options.readRemaining(fpinput);
     fclose(fpinput);
+    int threads = options.getInt("Number of threads", 0);
+    options.warnUnused();
 
     phantom target;
     cout << "Pre Phantom File name is: " << inphanfile << endl;
     cout << "Output Phantom file name will be: " << outphanfile << endl;
     cout << "The displacement matrix has a size of: " << dispSize << endl;
 
-    target.loadPhantom(inphanfile);
-
-    // this bit of the code allocates memory to contain a dispSize by dispSize
-    //       array of x and y displacements
-    double *u, *v;
-    u = new double[dispSize*dispSize];
-    v = new double[dispSize*dispSize];
+    // a comma separated list of displacement files gives a time series of
+    // frames, each displaced from the one before
+    std::vector<std::string> steps;
+    for (char* name = strtok(displfiles, ","); name != NULL; name = strtok(NULL, ","))
+        steps.push_back(name);
+    int frames = static_cast<int>(steps.size());
 
-    std::ifstream fpdisp;
-    fpdisp.open(displfile, std::ios::binary);
-    if ( !fpdisp.is_open() ) {
-        cout << "Error! Can't find file " << displfile << endl;
-        delete[] u;
-        delete[] v;
+    if (!target.loadPhantom(inphanfile))
         return -1;
-    }
-
-    // here the displacements are read in from the .dis file
-    fpdisp.read(reinterpret_cast<char*>(u), dispSize*dispSize*sizeof(double));
-    fpdisp.read(reinterpret_cast<char*>(v), dispSize*dispSize*sizeof(double));
-    fpdisp.close();
 
-    target.displaceAnsys(u, v, dispSize);
+    // The scatterers stay in memory from frame to frame.  Saving sorts them, and
+    // as one step only moves them a little the next sort just merges short runs.
+    std::string frameList;
+    for (int f = 0; f < frames; f++) {
+        // the matrix size is only used by displacement files of the old square format
+        displacementField field;
+        if (!field.loadFile(steps[f].c_str(), target.getPhanSize(), dispSize))
+            return -1;
+        cout << "Frame " << f + 1 << " of " << frames << ": " << steps[f] << ", a "
+             << (field.threeDimensional() ? "3-D" : "2-D") << " displacement grid" << endl;
+
+        target.displace(field, threads);
+
+        std::string frameName = frameFileName(outphanfile, f + 1, frames);
+        std::vector<char> writable(frameName.begin(), frameName.end());
+        writable.push_back('\0');
+        if (target.savePhantom(&writable[0]) < 0)
+            return -1;
+        frameList += (f ? "," : "") + frameName;
+    }
 
-    target.savePhantom(outphanfile);
+    if (frames > 1)
+        cout << "Phantom filename for rfDataProgram:" << frameList << endl;
 
     return 0;
 }
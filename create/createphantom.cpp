@@ -1,11 +1,16 @@
 #include <assert.h>
+#include <stdint.h>
 
+#include <algorithm>
 #include <cstdlib>
+#include <ctime>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <thread>
 
 #include "./phantom.h"
+#include "./settings.h"
 
 using std::cout;
 using std::endl;
@@ -57,6 +62,19 @@ int main(int argc, char* argv[]) {
     success = fscanf(fpinput, "%s", strPhanFile);
     assert(success == 1);
 
+    // A fixed seed gives the same phantom on every run and any thread count.
+    // 0 threads means one per hardware thread.
+    optionalSettings options;
+    options.readRemaining(fpinput);
+    fclose(fpinput);
+    uint64_t seed = static_cast<uint64_t>(time(NULL));
+    if (options.has("Random seed"))
+        seed = strtoull(options.getString("Random seed", "").c_str(), NULL, 10);
+    int threads = options.getInt("Number of threads", 0);
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    options.warnUnused();
+
     cout << "The x size is " << inSize.x << endl;
     cout << "The y size is " << inSize.y << endl;
     cout << "The z size is " << inSize.z <<endl;
@@ -64,8 +82,10 @@ int main(int argc, char* argv[]) {
     cout << "The filename is " << strPhanFile << endl;
     cout << "The sound Speed is " << c0 << endl;
     cout << "The attenuation is " << a0 <<" " << a1 << "  " << a2 << endl;
+    cout << "The random seed is " << seed << endl;
 
     phantom target;
-    target.createUniformPhantom(inSize, density, c0, a0, a1, a2, strBscFile);
+    target.createUniformPhantom(inSize, density, c0, a0, a1, a2, strBscFile,
+                                seed, threads);
         target.savePhantom(strPhanFile);
 }
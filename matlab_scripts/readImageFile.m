@@ -0,0 +1,33 @@
+function [data, fs, dynamicRange] = readImageFile(fname)
+%%Read an RF line or B-mode file written by rfDataProgram.
+%%INPUT:
+%%fname = name of the file given as "RF line output file" or
+%%        "B-mode output file" in the rfDataProgram input file
+%%OUTPUT:
+%%data         = samples x beamlines x frames, RF lines as single, B-mode
+%%               images as uint8 where 255 is the brightest point
+%%fs           = sampling frequency in Hz
+%%dynamicRange = dB below the brightest point shown as 0, B-mode only
+
+fp = fopen(fname, 'r');
+magic = fread(fp, 8, 'char=>char')';
+if ~strcmp(magic, ['USIMAGE' 0])
+    fclose(fp);
+    error('%s is not an image file written by rfDataProgram', fname);
+end
+fread(fp, 2, 'uint32');        % version, byte order check
+type = fread(fp, 1, 'uint32');
+samples = fread(fp, 1, 'uint32');
+beamlines = fread(fp, 1, 'uint32');
+frames = fread(fp, 1, 'uint32');
+fs = fread(fp, 1, 'double');
+dynamicRange = fread(fp, 1, 'double');
+fread(fp, 16, 'uint8');
+
+if type == 0
+    data = fread(fp, samples*beamlines*frames, 'single=>single');
+else
+    data = fread(fp, samples*beamlines*frames, 'uint8=>uint8');
+end
+fclose(fp);
+data = reshape(data, samples, beamlines, frames);
@@ -0,0 +1,42 @@
+function writeDisplacementGrid(fname, origin, spacing, U, W, V)
+%%Write a displacement file for compressPhantom on a rectangular grid.
+%%INPUT:
+%%fname   = output file name
+%%origin  = [x y z] position of the first grid point, in meters
+%%spacing = [dx dy dz] grid step along each axis, in meters
+%%U       = lateral (x) displacements in meters, indexed U(iz, ix) for a 2-D
+%%          grid or U(iz, iy, ix) for a 3-D grid
+%%W       = axial (z) displacements, same size as U
+%%V       = elevational (y) displacements, same size as U, 3-D grids only
+%%
+%%NOTE: the y entries of origin and spacing are ignored for 2-D grids
+
+threeD = nargin > 5;
+if threeD
+    pts = [size(U, 3) size(U, 2) size(U, 1)];
+    dims = 3;
+else
+    pts = [size(U, 2) 1 size(U, 1)];
+    dims = 2;
+    spacing(2) = 1;
+end
+
+h = fopen(fname, 'wb');
+fwrite(h, ['USDISPL' 0], 'char');
+fwrite(h, 1, 'uint32');            % version
+fwrite(h, 16909060, 'uint32');     % 0x01020304, byte order check
+fwrite(h, dims, 'uint32');
+fwrite(h, 0, 'uint32');
+fwrite(h, pts, 'uint64');
+fwrite(h, origin, 'double');
+fwrite(h, spacing, 'double');
+fwrite(h, zeros(1, 32), 'uint8');
+
+% z runs fastest, then y, then x, which is matlab's column major order
+fwrite(h, U(:), 'double');
+if threeD
+    fwrite(h, V(:), 'double');
+end
+fwrite(h, W(:), 'double');
+
+fclose(h);
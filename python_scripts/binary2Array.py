@@ -1,5 +1,6 @@
 def makeMultiFrameSimFile(fname, numFrames):
-	'''Read in multiple files with the name fname + number + .dat.  Save all those frames to a single file with one header. '''
+	'''Read in multiple files with the name fname + number + .dat.  Save all those frames to a single file with one header.
+	rfDataProgram writes this layout itself when it is given a comma separated list of phantoms.'''
 
 	import numpy as np
 	import struct
@@ -53,3 +54,42 @@ def makeMultiFrameSimFile(fname, numFrames):
 		for l in range(lines):
 			for p in range(points):
 				newFile.write(struct.pack('d', float(tempImag[p + l*points])))
+
+
+def readChunkedRfFile(fname):
+	'''Read a chunked RF file, written by rfDataProgram with "RF output format:chunked".
+	Returns (freqstep, data) with data a complex array of frames x lines x points, the same
+	values the legacy format holds.  Reading stops at a chunk that is cut short or fails its
+	checksum, as left by an interrupted run; the frequencies not read are zero.'''
+
+	import numpy as np
+	import struct
+	import zlib
+
+	fIn = open(fname, 'rb')
+	header = fIn.read(64)
+	if len(header) < 64 or header[:8] != b'USRFDAT\x00':
+		raise ValueError(fname + ' is not a chunked RF file')
+	version, endian, sampleType, points, lines, frames, freqstep = struct.unpack('<IIIIIId', header[8:40])
+	if endian != 0x01020304:
+		raise ValueError(fname + ' was written on a machine of different byte order')
+
+	sampleFormat = {0: np.double, 1: np.float32, 2: np.int16}[sampleType]
+	sampleBytes = np.dtype(sampleFormat).itemsize
+	data = np.zeros((frames, lines, points), dtype=complex)
+
+	while True:
+		chunk = fIn.read(24)
+		if len(chunk) < 24:
+			break
+		freqIndex, firstLine, lineCount, crc, scale = struct.unpack('<IIIId', chunk)
+		payload = fIn.read(2*frames*lineCount*sampleBytes)
+		if len(payload) < 2*frames*lineCount*sampleBytes or zlib.crc32(payload) & 0xffffffff != crc:
+			print('Stopped reading ' + fname + ' at a damaged chunk')
+			break
+		samples = np.frombuffer(payload, sampleFormat).astype(np.double)*scale
+		values = (samples[0::2] + 1j*samples[1::2]).reshape(frames, lineCount)
+		data[:, firstLine:firstLine + lineCount, freqIndex] = values
+
+	fIn.close()
+	return freqstep, data
@@ -6,16 +6,34 @@ import sys
 import numpy as np
 from matplotlib import pyplot
 from faranScattering import faranBsc
-f = open(sys.argv[1])
+f = open(sys.argv[1], 'rb')
 
-phanSizeX =float( np.fromfile(f, np.double,1) )
-phanSizeY = float( np.fromfile(f, np.double,1) )
-phanSizeZ = float( np.fromfile(f, np.double, 1) )
-totalScatters = int(np.fromfile(f, np.int32,1))
-c0 = float(np.fromfile(f, np.double, 1))
-a0 = float(np.fromfile(f, np.double,1))
-a1 = float(np.fromfile(f, np.double,1))
-a2 = float(np.fromfile(f, np.double,1))
+magic = f.read(8)
+if magic == b'USPHANT\0':
+	# phantom file with a header, see phantomFileHeader in common/phantom.h
+	version = int(np.fromfile(f, np.uint32, 1))
+	endian = int(np.fromfile(f, np.uint32, 1))
+	headerBytes, totalScatters, scattererOffset, bscOffset = [int(n) for n in np.fromfile(f, np.uint64, 4)]
+	phanSizeX, phanSizeY, phanSizeZ, c0, a0, a1, a2 = [float(n) for n in np.fromfile(f, np.double, 7)]
+	numBsc = int(np.fromfile(f, np.uint64, 1))
+	freqStep = float(np.fromfile(f, np.double, 1))
+	f.seek(bscOffset)
+	bsc = np.fromfile(f, np.double, numBsc)
+else:
+	# phantom file written before the header existed
+	f.seek(0)
+	phanSizeX =float( np.fromfile(f, np.double,1) )
+	phanSizeY = float( np.fromfile(f, np.double,1) )
+	phanSizeZ = float( np.fromfile(f, np.double, 1) )
+	totalScatters = int(np.fromfile(f, np.int32,1))
+	c0 = float(np.fromfile(f, np.double, 1))
+	a0 = float(np.fromfile(f, np.double,1))
+	a1 = float(np.fromfile(f, np.double,1))
+	a2 = float(np.fromfile(f, np.double,1))
+	scatterers = np.fromfile(f, np.double, 3*totalScatters)
+	numBsc = int(np.fromfile(f, np.int32, 1))
+	freqStep = float(np.fromfile(f, np.double, 1))
+	bsc = np.fromfile(f, np.double, numBsc)
 
 
 print 'Sound speed of: ' + str(c0)
@@ -23,10 +41,6 @@ print 'Attenuation of: ' + str(a0) + ' + ' + str(a1) +'^' + str(a2)
 print 'Phantom size of: ' + str(phanSizeX) + ', ' + str(phanSizeY) + ', ' + str(phanSizeZ)
 print "Total number of scatterers is: " + str(totalScatters)
 
-scatterers = np.fromfile(f, np.double, 3*totalScatters)
-numBsc = int(np.fromfile(f, np.int32, 1))
-freqStep = float(np.fromfile(f, np.double, 1))
-bsc = np.fromfile(f, np.double, numBsc)
 f.close()
 freq = np.arange(0, numBsc)*freqStep
 
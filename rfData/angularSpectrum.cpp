@@ -0,0 +1,292 @@
+#include "./angularSpectrum.h"
+
+#include <math.h>
+#include <assert.h>
+
+#include <algorithm>
+
+#include "./fastMath.h"
+
+namespace {
+
+// the smallest length of at least n made of factors 2, 3 and 5
+int niceLength(int n) {
+    for (int length = std::max(n, 1); ; length++) {
+        int rest = length;
+        while (rest%2 == 0) rest /= 2;
+        while (rest%3 == 0) rest /= 3;
+        while (rest%5 == 0) rest /= 5;
+        if (rest == 1) return length;
+    }
+}
+
+// the frequency of point m of a transform of n points, in FFT order
+int signedIndex(int m, int n) {
+    return m < (n+1)/2 ? m : m - n;
+}
+
+double sinc(double u) {
+    return u == 0 ? 1 : sin(u)/u;
+}
+
+// how far past the restriction the spectrum is rolled off to zero
+const double rollOff = 2.0;
+
+// the fewest wavenumber steps across the restriction that propagation is trusted with
+const double fewestSteps = 20;
+
+}  // namespace
+
+angularSpectrum::angularSpectrum(int count, double spacing, double width, double length,
+                                 double dx, int x, double dy, int y, double step)
+    : elements(count),
+      xPoints(x),
+      yRows(y),
+      xStep(dx),
+      yStep(dy),
+      dz(step),
+      K(cplxZero),
+      depth(0),
+      haveDepth(false),
+      sampled(false),
+      columnsValid(false) {
+    assert(elements > 0 && xPoints > 0 && yRows > 0);
+
+    double aperture = (elements - 1)*spacing + width;
+    xReach = (aperture + xPoints*dx)/2;
+    yReach = length/2 + yRows*dy;
+    // a wave rolled off at rollOff times the reach lands just short of wrapping into the
+    // plane from the far side
+    nx = niceLength(static_cast<int>(ceil((1 + rollOff)*xReach/dx)));
+    ny = niceLength(static_cast<int>(ceil((1 + rollOff)*yReach/dy)));
+    kxStep = 2*M_PI/(nx*dx);
+    kyStep = 2*M_PI/(ny*dy);
+    rowPlan = new fftPlan(nx);
+    columnPlan = new fftPlan(ny);
+
+    elementPhase.resize(static_cast<size_t>(nx)*elements);
+    for (int m = 0; m < nx; m++) {
+        double kx = kxStep*signedIndex(m, nx);
+        for (int j = 0; j < elements; j++) {
+            double xj = (j - (elements-1)/2.)*spacing;
+            elementPhase[m*elements + j] = exp(-imUnit*kx*xj);
+        }
+    }
+
+    // spectrum of an element face, scaled for the inverse transforms
+    double scale = 1/(nx*dx*ny*dy);
+    face.resize(static_cast<size_t>(nx)*ny);
+    for (int m = 0; m < nx; m++) {
+        double kx = kxStep*signedIndex(m, nx);
+        for (int n = 0; n < ny; n++) {
+            double ky = kyStep*signedIndex(n, ny);
+            face[m*ny + n] = scale*width*sinc(kx*width/2)*length*sinc(ky*length/2);
+        }
+    }
+
+    kz.resize(face.size());
+    source.resize(face.size());
+    stepPhase.resize(face.size());
+    spectrum.resize(face.size());
+    columns.resize(static_cast<size_t>(yRows)*nx);
+    arrayFactor.resize(nx);
+    work.resize(std::max(nx, ny));
+}
+
+angularSpectrum::~angularSpectrum() {
+    delete rowPlan;
+    delete columnPlan;
+}
+
+/*!  Near the circle kx^2 + ky^2 = k^2, where the waves travel parallel to the aperture, 1/kz
+ * is as large as the attenuation lets it be, and without attenuation infinite.  Its
+ * magnitude is limited to what it is a quarter of a wavenumber step inside the circle.
+ */
+void angularSpectrum::setWavenumber(const cplx& wavenumber) {
+    K = wavenumber;
+    double smallest = sqrt(2*std::abs(K)*0.25*std::min(kxStep, kyStep));
+    for (int m = 0; m < nx; m++) {
+        double kx = kxStep*signedIndex(m, nx);
+        for (int n = 0; n < ny; n++) {
+            double ky = kyStep*signedIndex(n, ny);
+            size_t k = static_cast<size_t>(m)*ny + n;
+
+            // the root with a positive imaginary part, decaying with depth
+            kz[k] = sqrt(K*K - kx*kx - ky*ky);
+            cplx divisor = kz[k];
+            if (std::abs(divisor) < smallest)
+                divisor = std::abs(divisor) > 0 ? divisor*(smallest/std::abs(divisor))
+                                                : cplx(smallest, 0);
+            source[k] = 2*M_PI*imUnit*face[k]/divisor;
+            stepPhase[k] = exp(imUnit*kz[k]*dz);
+        }
+    }
+    haveDepth = false;
+    sampled = false;
+    columnsValid = false;
+}
+
+/*!  Planes are normally calculated in order of depth, each one a step on from the last,
+ * when the spectrum is the last one times exp(i kz dz).  Any other depth is worked out
+ * from the source.  The field behind the aperture is the mirror image of that in front.
+ *
+ * Deep down, or at long wavelengths, the cone of waves that reach the plane is only a few
+ * wavenumber steps across and the propagated spectrum is too coarse to describe it.  From
+ * there on the spectrum is that of exp(iKR)/R sampled on the grid instead, see
+ * sampleGreen.
+ */
+void angularSpectrum::setDepth(double z) {
+    z = fabs(z);
+    size_t count = spectrum.size();
+    if (!propagates(z)) {
+        if (!haveDepth || !sampled || z != depth)
+            sampleGreen(z);
+        sampled = true;
+    } else if (haveDepth && !sampled && fabs(z - depth - dz) < 1e-6*dz) {
+        for (size_t k = 0; k < count; k++)
+            spectrum[k] *= stepPhase[k];
+    } else if (!haveDepth || sampled || z != depth) {
+        for (size_t k = 0; k < count; k++)
+            spectrum[k] = source[k]*exp(imUnit*kz[k]*z);
+        sampled = false;
+    }
+    depth = z;
+    haveDepth = true;
+    columnsValid = false;
+}
+
+/*!  Whether at depth z the waves that reach the plane span at least fewestSteps
+ * wavenumber steps both ways.
+ */
+bool angularSpectrum::propagates(double z) const {
+    double k = K.real();
+    double xSine = xReach/sqrt(xReach*xReach + z*z);
+    double ySine = yReach/sqrt(yReach*yReach + z*z);
+    return k*xSine >= fewestSteps*kxStep && k*ySine >= fewestSteps*kyStep;
+}
+
+/*!  The spectrum at depth z from exp(iKR)/R at the points of the grid, transformed
+ * forward in both directions, times the spectrum of the element face: the face convolved
+ * with the sampled Green's function, as FOCUS does it.  The
+ * grid is wider than the aperture and the plane together, so the convolution does not
+ * wrap around, and at depths where this is used exp(iKR)/R changes little from one point to
+ * the next.  Close to the face no sample is larger than 1/R integrated over its cell in the
+ * plane of the face.
+ */
+void angularSpectrum::sampleGreen(double z) {
+    double area = xStep*yStep;
+    double a = xStep/2, b = yStep/2;
+    double largest = 4*(a*asinh(b/a) + b*asinh(a/b));
+    double k = K.real(), attenuation = K.imag();
+
+    // exp(iKR)/R is even in x and y and so is its spectrum: a quarter of the samples and
+    // half of the transforms each way are worked out, the rest are copied
+    int xHalf = nx/2, yHalf = ny/2;
+    for (int m = 0; m <= xHalf; m++) {
+        double x = xStep*m;
+        cplx* column = &spectrum[static_cast<size_t>(m)*ny];
+        for (int n = 0; n <= yHalf; n++) {
+            double y = yStep*n;
+            double R = sqrt(x*x + y*y + z*z);
+            double sn, cs;
+            sinCos(k*R, &sn, &cs);
+            double magnitude = expNoBranch(-attenuation*R)*
+                               (R*largest > area ? area/R : largest);
+            column[n] = cplx(magnitude*cs, magnitude*sn);
+        }
+        for (int n = yHalf + 1; n < ny; n++)
+            column[n] = column[ny - n];
+        columnPlan->transform(column, false);
+    }
+    for (int m = xHalf + 1; m < nx; m++)
+        std::copy(&spectrum[static_cast<size_t>(nx - m)*ny],
+                  &spectrum[static_cast<size_t>(nx - m + 1)*ny],
+                  &spectrum[static_cast<size_t>(m)*ny]);
+
+    for (int n = 0; n <= yHalf; n++) {
+        for (int m = 0; m < nx; m++)
+            work[m] = spectrum[static_cast<size_t>(m)*ny + n];
+        rowPlan->transform(work.data(), false);
+        for (int m = 0; m < nx; m++) {
+            size_t k = static_cast<size_t>(m)*ny + n;
+            spectrum[k] = face[k]*work[m];
+            if (n > 0 && 2*n != ny)
+                spectrum[k + ny - 2*n] = spectrum[k];
+        }
+    }
+}
+
+/*!  The spectrum transformed along ky, at the wanted rows.  Waves steeper than the line
+ * from one edge of the aperture to the far edge of the field plane never reach the plane
+ * except by wrapping around the transform grid, so they are left out of a propagated
+ * spectrum (the angular restriction of Zeng and McGough).  Cutting them off sharply rings
+ * across the plane, so the spectrum is rolled off with a half cosine out to rollOff times
+ * that slope instead.  The grid is sized so that none of it wraps around.
+ */
+void angularSpectrum::transformColumns() {
+    double xSlope = xReach/std::max(depth, 1e-12);
+    double ySlope = yReach/std::max(depth, 1e-12);
+
+    for (int m = 0; m < nx; m++) {
+        const cplx* column = &spectrum[static_cast<size_t>(m)*ny];
+        if (sampled) {
+            std::copy(column, column + ny, work.begin());
+        } else {
+            double kx = kxStep*signedIndex(m, nx);
+            bool reaches = false;
+            for (int n = 0; n < ny; n++) {
+                double ky = kyStep*signedIndex(n, ny);
+                double travel = kz[static_cast<size_t>(m)*ny + n].real();
+                double u = travel > 0 ? std::max(fabs(kx)/xSlope, fabs(ky)/ySlope)/travel
+                                      : rollOff;
+                if (u >= rollOff) {
+                    work[n] = cplxZero;
+                    continue;
+                }
+                work[n] = u <= 1 ? column[n]
+                                 : 0.5*(1 + cos(M_PI*(u - 1)/(rollOff - 1)))*column[n];
+                reaches = true;
+            }
+
+            // none of this kx reaches the plane
+            if (!reaches) {
+                for (int r = 0; r < yRows; r++)
+                    columns[static_cast<size_t>(r)*nx + m] = cplxZero;
+                continue;
+            }
+        }
+
+        columnPlan->transform(work.data(), true);
+        for (int r = 0; r < yRows; r++) {
+            int n = (ny - (yRows - 1 - r))%ny;
+            columns[static_cast<size_t>(r)*nx + m] = work[n];
+        }
+    }
+    columnsValid = true;
+}
+
+void angularSpectrum::planeField(const cplx* weights, cplx* field) {
+    assert(haveDepth);
+    if (!columnsValid) transformColumns();
+
+    for (int m = 0; m < nx; m++) {
+        const cplx* phase = &elementPhase[static_cast<size_t>(m)*elements];
+        cplx sum = cplxZero;
+        for (int j = 0; j < elements; j++)
+            sum += weights[j]*phase[j];
+        arrayFactor[m] = sum;
+    }
+
+    for (int r = 0; r < yRows; r++) {
+        const cplx* row = &columns[static_cast<size_t>(r)*nx];
+        for (int m = 0; m < nx; m++)
+            work[m] = arrayFactor[m]*row[m];
+        rowPlan->transform(work.data(), true);
+
+        cplx* out = field + static_cast<size_t>(r)*xPoints;
+        for (int i = 0; i < xPoints; i++) {
+            int m = ((i - (xPoints-1)/2)%nx + nx)%nx;
+            out[i] = work[m];
+        }
+    }
+}
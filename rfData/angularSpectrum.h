@@ -0,0 +1,85 @@
+#ifndef RFDATA_ANGULARSPECTRUM_H_
+#define RFDATA_ANGULARSPECTRUM_H_
+
+#include <vector>
+
+#include "./fft.h"
+#include "./util.h"
+
+/*! \brief The field of a linear array, a depth plane at a time, by angular spectrum
+ * propagation.
+ *
+ * The field of an element is the Rayleigh integral of exp(iKR)/R over its face, which is
+ * what fieldBuffer::getSingleElementField approximates.  In the lateral and elevational
+ * wavenumbers (kx, ky) it is the spectrum of the aperture times 2 pi i exp(i kz z)/kz,
+ * kz = sqrt(K^2 - kx^2 - ky^2), with the attenuation in the imaginary part of K.  The
+ * spectrum of the rectangular elements is known exactly, a product of sincs times the sum of
+ * the element weights at their positions, so the aperture is not sampled.  Each plane then
+ * takes inverse FFTs along ky, shared by every set of weights, and along kx for the rows
+ * that are wanted: O(n log n) in the points of the plane, whatever the number of elements.
+ *
+ * At each depth the waves too steep to reach the field plane from the aperture are rolled
+ * off, and the transform grid is just large enough that what is left does not wrap around
+ * it: one and a half times the aperture and the field together, each way.
+ * Waves steeper than the grid step can hold (a step above half a wavelength) are left out
+ * too, and 1/kz is kept below the inverse of a quarter of the wavenumber step near kz = 0.
+ *
+ * Propagating the spectrum is most accurate close to the aperture.  Further down the waves
+ * that reach the plane take up fewer and fewer wavenumber steps, and there the spectrum of
+ * exp(iKR)/R is instead taken from its samples on the grid, still O(n log n) a plane.
+ */
+class angularSpectrum {
+ public:
+  angularSpectrum(int elements, double spacing, double width, double length,
+                  double dx, int xPoints, double dy, int yRows, double dz);
+  // elements of width by length, spacing apart.  The field is found at xPoints
+  // lateral points dx apart centred on the array, and at the yRows elevational
+  // rows -(yRows-1)dy to 0, at depths dz apart.
+  ~angularSpectrum();
+
+  void setWavenumber(const cplx& wavenumber);
+  // the wavenumber of the frequency, before the first depth
+
+  void setDepth(double z);
+  // the plane to calculate, a step on from the last one is cheaper
+
+  void planeField(const cplx* weights, cplx* field);
+  // the field of the array with element weights at the plane, row by row
+  // from y = -(yRows-1)dy, xPoints values a row
+
+  int gridWidth() const { return nx; }
+  int gridHeight() const { return ny; }
+
+ private:
+  int elements;
+  int xPoints, yRows;
+  double xStep, yStep, dz;
+  cplx K;
+  int nx, ny;               // transform grid
+  double kxStep, kyStep;    // and its wavenumber steps
+  double xReach, yReach;    // furthest from an element to a point of the plane
+  fftPlan *rowPlan, *columnPlan;
+
+  std::vector<cplx> elementPhase;  // exp(-i kx x_j), element changing fastest
+  std::vector<double> face;        // spectrum of an element face, ky changing fastest
+  std::vector<cplx> source;        // element face spectrum times 2 pi i/kz, scaled
+  std::vector<cplx> kz;
+  std::vector<cplx> stepPhase;     // exp(i kz dz)
+  std::vector<cplx> spectrum;      // source times exp(i kz z) at the current depth
+  std::vector<cplx> columns;       // spectrum transformed along ky, wanted rows only
+  std::vector<cplx> arrayFactor;   // sum of weight times elementPhase, for each kx
+  std::vector<cplx> work;
+  double depth;
+  bool haveDepth;
+  bool sampled;             // spectrum from the sampled Green's function
+  bool columnsValid;
+
+  angularSpectrum(const angularSpectrum&);
+  angularSpectrum& operator=(const angularSpectrum&);
+
+  bool propagates(double z) const;
+  void sampleGreen(double z);
+  void transformColumns();
+};
+
+#endif  // RFDATA_ANGULARSPECTRUM_H_
@@ -0,0 +1,66 @@
+#include "./beamGeometry.h"
+
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+beamGeometry::beamGeometry(): firstBeam(0) {}
+
+/*!  Find the scatterers of beamlines first to first+beamlines-1 and where they fall in the
+ * field buffer.  The phantom must already be sorted.  Any field buffer with the same grid as
+ * the ones used in the frequency loop can be passed, its contents are not used.
+ * Only scatterers inside the field buffer are kept: the phantom's bucket index returns those
+ * in the box of the beam, and the few on its edge are checked against the buffer grid.
+ * The positions within the grid cells are only kept for the interpolating modes.
+ */
+void beamGeometry::build(phantom* target,
+                         fieldBuffer* pressure,
+                         int first,
+                         int beamlines,
+                         double beamspacing,
+                         double beamWidth) {
+    firstBeam = first;
+    beamStart.assign(beamlines + 1, 0);
+    table.clear();
+    fraction.clear();
+    bool interpolating = pressure->giveInterpolation() != nearestPoint;
+
+    // the x window of every beam holds all its scatterers, so this bounds the table size
+    size_t windowed = 0;
+    for (int i=0; i < beamlines; i++) {
+        double leftEnd = (first + i)*beamspacing;
+        scatterer *pos;
+        windowed += target->getScattersBetween(leftEnd, leftEnd + beamWidth, &pos);
+    }
+    table.reserve(windowed);
+    if (interpolating) fraction.reserve(windowed);
+
+    myVector lower(0, 0, 0), upper(0, 0, 0);
+    pressure->phantomExtent(&lower, &upper);
+
+    std::vector<int64_t> found;
+    for (int i=0; i < beamlines; i++) {
+        lower.x = (first + i)*beamspacing;
+        upper.x = lower.x + beamWidth;
+        found.clear();
+        target->getScattersInBox(lower, upper, &found);
+
+        for (size_t j=0; j < found.size(); j++) {
+            vector loc = pressure->phantomCoordinateToPressureCoordinate(
+                                      target->getScatterer(found[j]), first + i);
+            if (pressure->inBuffer(loc)) {
+                cellFraction f;
+                table.push_back(pressure->bufferIndex(loc, &f));
+                if (interpolating) fraction.push_back(f);
+            }
+        }
+        beamStart[i+1] = table.size();
+    }
+
+    cout << "The beam geometry table holds " << table.size()
+         << " scatterer positions";
+    if (table.size() < windowed)
+        cout << ", " << windowed - table.size() << " outside the field were skipped";
+    cout << endl;
+}
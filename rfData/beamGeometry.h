@@ -0,0 +1,52 @@
+#ifndef RFDATA_BEAMGEOMETRY_H_
+#define RFDATA_BEAMGEOMETRY_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "./phantom.h"
+#include "./pressureField.h"
+
+/*! \brief The frequency independent part of imaging a phantom: for every beamline, where each
+ * scatterer inside the beam falls in the field buffer.
+ *
+ * Finding the scatterers of a beam and converting them to field buffer indices gives the same
+ * answer at every frequency.  This class does that work once, before the frequency loop, so
+ * that the loop only has to gather buffer values and accumulate them.
+ * A scatterer appears once for every beam it falls in, so the table holds roughly
+ * beamWidth/beamspacing entries per scatterer.
+ */
+class beamGeometry {
+ public:
+  beamGeometry();
+
+  // (phantom, field buffer giving the grid, first beamline, beamlines,
+  //  beam spacing, beam width)
+  void build(phantom* target,
+             fieldBuffer* pressure,
+             int first,
+             int beamlines,
+             double beamspacing,
+             double beamWidth);
+
+  int firstBeamline() const { return firstBeam; }
+  int beamlines() const { return static_cast<int>(beamStart.size()) - 1; }
+
+  // number of scatterers in beamline firstBeamline()+i and their buffer samples
+  size_t count(int i) const { return beamStart[i+1] - beamStart[i]; }
+  const fieldSample* samples(int i) const { return &table[beamStart[i]]; }
+
+  // their positions in the grid cells, NULL in nearest point interpolation
+  const cellFraction* fractions(int i) const {
+      return fraction.empty() ? NULL : &fraction[beamStart[i]];
+  }
+
+ private:
+  int firstBeam;
+  std::vector<size_t> beamStart;  // first entry of each beamline, plus the total
+  std::vector<fieldSample> table;
+  std::vector<cellFraction> fraction;  // same order as table, interpolating modes only
+};
+
+#endif  // RFDATA_BEAMGEOMETRY_H_
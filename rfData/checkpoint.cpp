@@ -0,0 +1,138 @@
+#include "./checkpoint.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char checkpointMagic[8] = {'U', 'S', 'C', 'H', 'K', 'P', 'T', '\0'};
+const uint32_t checkpointVersion = 1;
+const uint32_t endianMark = 0x01020304;
+
+}  // namespace
+
+static_assert(sizeof(checkpointHeader) == 64, "checkpoint header must be 64 bytes");
+
+bool hashFile(const char* filename, uint64_t* h) {
+    std::ifstream fpin(filename, std::ios::binary);
+    if (!fpin.is_open()) return false;
+
+    std::vector<char> piece(1 << 20);
+    while (fpin) {
+        fpin.read(piece.data(), piece.size());
+        *h = hashBytes(piece.data(), static_cast<size_t>(fpin.gcount()), *h);
+    }
+    return fpin.eof();
+}
+
+checkpoint::checkpoint(const std::string& name, uint64_t input, uint64_t phantoms)
+    : filename(name),
+      inputHash(input),
+      phantomHash(phantoms)
+{}
+
+/*!  Beamlines are written one at a time, with the coefficients of unfinished frequencies
+ * replaced by zero, so no copy of fftCoef is needed.
+ */
+int checkpoint::save(const cplx* fftCoef, int freqPoints, int beamlines, int frames,
+                     int blockFirst, int blockCount, const std::vector<char>& done) {
+    std::string tmpName = filename + ".tmp";
+    std::ofstream fpout(tmpName.c_str(), std::ios::binary);
+    if (!fpout.is_open()) {
+        cout << "Unable to write checkpoint file " << tmpName << endl;
+        return 0;
+    }
+
+    checkpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.endian = endianMark;
+    header.inputHash = inputHash;
+    header.phantomHash = phantomHash;
+    header.freqPoints = freqPoints;
+    header.beamlines = beamlines;
+    header.frames = frames;
+    header.blockFirst = blockFirst;
+    header.blockCount = blockCount;
+    fpout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fpout.write(done.data(), freqPoints);
+
+    std::vector<cplx> line(freqPoints);
+    for (int f = 0; f < frames; f++) {
+        for (int l = 0; l < beamlines; l++) {
+            const cplx* lineCoef = fftCoef
+                + (static_cast<size_t>(f)*beamlines + l)*freqPoints;
+            for (int k = 0; k < freqPoints; k++) {
+                bool finished = l < blockFirst ||
+                                (l < blockFirst + blockCount && done[k]);
+                line[k] = finished ? lineCoef[k] : cplxZero;
+            }
+            fpout.write(reinterpret_cast<const char*>(line.data()),
+                        sizeof(cplx)*freqPoints);
+        }
+    }
+    fpout.close();
+
+    if (!fpout || rename(tmpName.c_str(), filename.c_str()) != 0) {
+        cout << "Unable to write checkpoint file " << filename << endl;
+        ::remove(tmpName.c_str());
+        return 0;
+    }
+    return 1;
+}
+
+int checkpoint::load(cplx* fftCoef, int freqPoints, int beamlines, int frames,
+                     int* blockFirst, int* blockCount, std::vector<char>* done) {
+    std::ifstream fpin(filename.c_str(), std::ios::binary);
+    if (!fpin.is_open()) {
+        cout << "Error! Can't find checkpoint file " << filename << endl;
+        return 0;
+    }
+
+    checkpointHeader header;
+    fpin.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!fpin || memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0 ||
+        header.version != checkpointVersion || header.endian != endianMark) {
+        cout << "Error! " << filename << " is not a checkpoint this program can read" << endl;
+        return 0;
+    }
+    if (header.inputHash != inputHash) {
+        cout << "Error! The input file has changed since checkpoint " << filename
+             << " was written" << endl;
+        return 0;
+    }
+    if (header.phantomHash != phantomHash) {
+        cout << "Error! The phantom has changed since checkpoint " << filename
+             << " was written" << endl;
+        return 0;
+    }
+    if (header.freqPoints != static_cast<uint32_t>(freqPoints) ||
+        header.beamlines != static_cast<uint32_t>(beamlines) ||
+        header.frames != static_cast<uint32_t>(frames)) {
+        cout << "Error! Checkpoint " << filename << " is of a different size" << endl;
+        return 0;
+    }
+
+    done->resize(freqPoints);
+    fpin.read(done->data(), freqPoints);
+    fpin.read(reinterpret_cast<char*>(fftCoef),
+              sizeof(cplx)*freqPoints*static_cast<size_t>(beamlines)*frames);
+    if (!fpin) {
+        cout << "Error! Checkpoint file " << filename << " is too short" << endl;
+        return 0;
+    }
+    *blockFirst = header.blockFirst;
+    *blockCount = header.blockCount;
+    return 1;
+}
+
+void checkpoint::remove() {
+    ::remove(filename.c_str());
+}
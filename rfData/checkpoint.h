@@ -0,0 +1,68 @@
+#ifndef RFDATA_CHECKPOINT_H_
+#define RFDATA_CHECKPOINT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "./util.h"
+
+/*! \brief The header of a checkpoint file, 64 bytes.
+ *
+ * It is followed by freqPoints bytes, one for each frequency index, that are 1 for the
+ * frequencies finished in the block of beamlines being imaged, and then the coefficients
+ * laid out as fftCoef in rf_data.cpp.  Beamlines before blockFirst are finished at every
+ * frequency.  Coefficients that were not finished are stored as zero.
+ */
+struct checkpointHeader {
+    char magic[8];        // "USCHKPT" and a terminating zero
+    uint32_t version;
+    uint32_t endian;      // 0x01020304 as written by the machine that wrote it
+    uint64_t inputHash;   // hash of the input file
+    uint64_t phantomHash; // hash of the phantom files
+    uint32_t freqPoints;
+    uint32_t beamlines;
+    uint32_t frames;
+    uint32_t blockFirst;  // first beamline of the block being imaged
+    uint32_t blockCount;  // beamlines in that block
+    char reserved[12];
+};
+
+/*! \brief Periodic snapshots of the finished part of a simulation, so an interrupted run
+ * can be resumed.
+ *
+ * Only finished coefficients are read from fftCoef, so a snapshot can be taken while
+ * workers are still adding to the others.  Snapshots are written under a temporary name and
+ * renamed, so a run interrupted while writing one still has the previous one.
+ */
+class checkpoint {
+ public:
+  checkpoint(const std::string& filename, uint64_t inputHash, uint64_t phantomHash);
+
+  // write a snapshot.  done has an entry per frequency index, non-zero for the
+  // frequencies finished in the block blockFirst to blockFirst+blockCount-1.
+  // Returns 1 on success.
+  int save(const cplx* fftCoef, int freqPoints, int beamlines, int frames,
+           int blockFirst, int blockCount, const std::vector<char>& done);
+
+  // read the snapshot into fftCoef, which must be zero, after checking that it
+  // was taken of the same simulation.  Returns 1 on success.
+  int load(cplx* fftCoef, int freqPoints, int beamlines, int frames,
+           int* blockFirst, int* blockCount, std::vector<char>* done);
+
+  // delete the snapshot once the run has finished
+  void remove();
+
+  const std::string& name() const { return filename; }
+
+ private:
+  std::string filename;
+  uint64_t inputHash;
+  uint64_t phantomHash;
+};
+
+// hash the contents of a file, continuing from h, returns false if it can't be read
+bool hashFile(const char* filename, uint64_t* h);
+
+#endif  // RFDATA_CHECKPOINT_H_
@@ -0,0 +1,106 @@
+#include "./delayTable.h"
+
+#include <math.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <string>
+
+#include "./fastMath.h"
+
+delayTable::delayTable(int count, double s, double speed)
+    : elements(count),
+      spacing(s),
+      soundSpeed(speed),
+      fNumber(-1),
+      window(rectWindow),
+      taper(0.5) {
+    assert(elements > 0);
+}
+
+void delayTable::setAperture(double F, apodizationWindow w, double t) {
+    fNumber = F;
+    window = w;
+    taper = t;
+}
+
+/*!  Weight at u, 0 to 1 across the active aperture.
+ */
+double delayTable::windowWeight(double u) const {
+    switch (window) {
+        case hannWindow: {
+            double s = sin(M_PI*u);
+            return s*s;
+        }
+        case tukeyWindow: {
+            double edge = std::min(u, 1 - u);
+            if (taper <= 0 || edge >= taper/2) return 1;
+            return 0.5*(1 - cos(2*M_PI*edge/taper));
+        }
+        default:
+            return 1;
+    }
+}
+
+void delayTable::setFoci(const std::vector<double>& focalDepths) {
+    depths = focalDepths;
+    delays.assign(depths.size()*elements, 0.0);
+    weights.assign(depths.size()*elements, 0.0);
+
+    for (size_t f = 0; f < depths.size(); f++) {
+        double focus = depths[f];
+        double* delay = &delays[f*elements];
+        double* weight = &weights[f*elements];
+
+        // to focus to infinity
+        if (focus <= 0) {
+            for (int i = 0; i < elements; i++)
+                weight[i] = 1;
+            continue;
+        }
+
+        // the number of active elements, even and at most all of them
+        int active = static_cast<int>(focus/(fNumber*spacing));
+        if (active%2 == 1) active++;
+        if (active < 1 || active > elements)
+            active = elements;
+
+        int first = (elements - active)/2;
+        for (int i = first; i < first + active; i++) {
+            double xLoc = (i-(elements-1)/2.)*spacing;
+            delay[i] = (focus - sqrt((xLoc*xLoc) + focus*focus))/soundSpeed;
+            weight[i] = windowWeight((i - first + 0.5)/active);
+        }
+    }
+}
+
+/*!  Inactive elements have zero weight and come out as zero.
+ */
+void delayTable::phases(int focus, double freq, cplx* phase) const {
+    assert(focus >= 0 && focus < foci());
+
+    const double* delay = &delays[static_cast<size_t>(focus)*elements];
+    const double* weight = &weights[static_cast<size_t>(focus)*elements];
+    double* out = reinterpret_cast<double*>(phase);
+    double omega = 2*M_PI*freq;
+
+    for (int i = 0; i < elements; i++) {
+        double sn, cs;
+        sinCos(omega*delay[i], &sn, &cs);
+        out[2*i] = weight[i]*cs;
+        out[2*i+1] = weight[i]*sn;
+    }
+}
+
+bool parseApodization(const std::string& name, apodizationWindow* window) {
+    if (name == "rect") {
+        *window = rectWindow;
+    } else if (name == "hann") {
+        *window = hannWindow;
+    } else if (name == "tukey") {
+        *window = tukeyWindow;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef RFDATA_DELAYTABLE_H_
+#define RFDATA_DELAYTABLE_H_
+
+#include <string>
+#include <vector>
+
+#include "./util.h"
+
+/*! \brief The apodization across the active aperture.
+ *
+ * rectWindow weighs every active element the same, as the array always did.  hannWindow
+ * is sin^2 across the aperture.  tukeyWindow is flat in the middle with cosine tapers over
+ * a fraction of the aperture at the two ends, a fraction of 0 is rectWindow and 1 is
+ * hannWindow.
+ */
+enum apodizationWindow {
+    rectWindow,
+    hannWindow,
+    tukeyWindow
+};
+
+/*! \brief Focusing delays and apodization weights of the elements of an array, for a list
+ * of focal depths.
+ *
+ * Neither depends on frequency, so they are worked out once.  The phase factors of a
+ * frequency, weight*exp(2 pi i f delay), then take a rotation per element in a loop
+ * without library calls.  The active aperture at each depth is set by the F number as in
+ * array::setFocus: depth/(F spacing) elements rounded up to even, or all of them if that
+ * is more than there are, or F is negative.  A depth of zero or less is not focused, and
+ * all elements are then active with equal weights.
+ */
+class delayTable {
+ public:
+  delayTable(int elements, double spacing, double soundSpeed);
+
+  void setAperture(double fNumber, apodizationWindow window, double taper);
+  // F number, window and the Tukey taper fraction, call before setFoci
+
+  void setFoci(const std::vector<double>& depths);
+  int foci() const { return static_cast<int>(depths.size()); }
+  // work out the delays and weights of each focal depth
+
+  void phases(int focus, double freq, cplx* phase) const;
+  // the phase factor of each element for focus number (focus) at frequency (freq)
+
+  double weight(int focus, int element) const {
+      return weights[static_cast<size_t>(focus)*elements + element];
+  }
+
+ private:
+  int elements;
+  double spacing;
+  double soundSpeed;
+  double fNumber;
+  apodizationWindow window;
+  double taper;
+
+  std::vector<double> depths;
+  std::vector<double> delays;    // seconds, focus changing slowest
+  std::vector<double> weights;   // 0 outside the active aperture
+
+  double windowWeight(double u) const;
+};
+
+// parse rect, hann or tukey, returns false for anything else
+bool parseApodization(const std::string& name, apodizationWindow* window);
+
+#endif  // RFDATA_DELAYTABLE_H_
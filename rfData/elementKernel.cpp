@@ -0,0 +1,92 @@
+#include "./elementKernel.h"
+
+#include <algorithm>
+
+#include "./fastMath.h"
+
+// GCC makes a copy of these functions for each target and a resolver that picks one when
+// the program is loaded.  Elsewhere there is only the plain copy.
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && defined(__linux__)
+#define ELEMENT_KERNEL_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#define ELEMENT_KERNEL_DISPATCH
+#else
+#define ELEMENT_KERNEL_CLONES
+#endif
+
+namespace {
+
+/*!  Everything of the field of each point but the Fresnel integrals, as getSingleElementField
+ * works it out.  There beta = 1/(2r) is positive for every r below 1e7, so only its beta > 0
+ * case is needed.  The two complex exponentials are merged into one,
+ * exp(iK(r - y yOverTwoRBeta/(2r))).
+ */
+ELEMENT_KERNEL_CLONES
+void rowTerms(const double* x, int n, double y, double z, double width, double length,
+              double k, double attenuation, double* amplitude, double* cosPhase,
+              double* sinPhase, double* limits) {
+    for (int i = 0; i < n; i++) {
+        double r = std::max(sqrt(x[i]*x[i] + y*y + z*z), 2E-10);
+        double beta = 1/(2*r);
+        double yOverTwoRBeta = y/(2*r*beta);
+
+        double argX = (k*x[i]*width)/(2*M_PI*r);
+        double sn, cs;
+        sinCos(argX, &sn, &cs);
+        double sincX = fabs(argX) < 1E-8 ? 1. : sn/argX;
+
+        double path = r - y*yOverTwoRBeta/(2*r);
+        amplitude[i] = (width/r)*sqrt(M_PI/(2*k*beta))*sincX*expNoBranch(-attenuation*path);
+        sinCos(k*path, &sinPhase[i], &cosPhase[i]);
+
+        double factor = sqrt(2*k*beta/M_PI);
+        limits[2*i] = factor*(length/2 - yOverTwoRBeta);
+        limits[2*i+1] = factor*(-length/2 - yOverTwoRBeta);
+    }
+}
+
+ELEMENT_KERNEL_CLONES
+void combineRow(int n, const double* amplitude, const double* cosPhase, const double* sinPhase,
+                const double* integrals, double* field) {
+    for (int i = 0; i < n; i++) {
+        double c = integrals[4*i] - integrals[4*i+2];
+        double s = integrals[4*i+1] - integrals[4*i+3];
+        field[2*i] = amplitude[i]*(cosPhase[i]*c - sinPhase[i]*s);
+        field[2*i+1] = amplitude[i]*(cosPhase[i]*s + sinPhase[i]*c);
+    }
+}
+
+}  // namespace
+
+elementRowKernel::elementRowKernel(int maxPoints)
+    : amplitude(maxPoints),
+      cosPhase(maxPoints),
+      sinPhase(maxPoints),
+      limits(2*maxPoints),
+      integrals(2*maxPoints)
+{}
+
+/*!  Three passes over the row: the terms of each point, the Fresnel integrals of all of
+ * them, and their products.  cplx arrays are read as interleaved doubles, as the standard
+ * allows.
+ */
+void elementRowKernel::evaluate(const double* x, int n, double y, double z,
+                                double width, double length, const cplx& K,
+                                const fresnelInt& fres, cplx* field) {
+    assert(n <= static_cast<int>(amplitude.size()));
+
+    rowTerms(x, n, y, z, width, length, K.real(), K.imag(),
+             amplitude.data(), cosPhase.data(), sinPhase.data(), limits.data());
+    fres.fastFresnel(limits.data(), integrals.data(), 2*n);
+    combineRow(n, amplitude.data(), cosPhase.data(), sinPhase.data(),
+               reinterpret_cast<const double*>(integrals.data()),
+               reinterpret_cast<double*>(field));
+}
+
+const char* elementKernelTarget() {
+#ifdef ELEMENT_KERNEL_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return "AVX-512";
+    if (__builtin_cpu_supports("avx2")) return "AVX2";
+#endif
+    return "generic";
+}
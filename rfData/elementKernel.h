@@ -0,0 +1,39 @@
+#ifndef RFDATA_ELEMENTKERNEL_H_
+#define RFDATA_ELEMENTKERNEL_H_
+
+#include <vector>
+
+#include "./util.h"
+
+/*! \brief The field of a single rectangular element at a whole lateral row of points.
+ *
+ * This is fieldBuffer::getSingleElementField for every x of a row at one y and z.  The
+ * inputs and the intermediate values are kept as separate arrays of doubles, so the sines,
+ * cosines and exponentials of the row are evaluated in loops the compiler vectorizes.
+ * On x86-64 with GCC the loops are compiled for AVX-512, AVX2 and plain x86-64, and the
+ * best one the processor supports is chosen when the program starts.
+ *
+ * Each kernel has its own work arrays, so one kernel can't be used by two threads at once.
+ */
+class elementRowKernel {
+ public:
+  explicit elementRowKernel(int maxPoints);
+
+  // the field at (x[i], y, z), i = 0 to n-1, of an element width by length,
+  // for wavenumber K
+  void evaluate(const double* x, int n, double y, double z,
+                double width, double length, const cplx& K,
+                const fresnelInt& fres, cplx* field);
+
+ private:
+  std::vector<double> amplitude;  // magnitude of everything but the Fresnel integrals
+  std::vector<double> cosPhase;   // and the cosine and sine of its phase
+  std::vector<double> sinPhase;
+  std::vector<double> limits;     // Fresnel arguments, upper and lower limit of each point
+  std::vector<cplx> integrals;    // and the Fresnel integrals at them
+};
+
+// the instruction set the kernel runs with on this processor, AVX-512, AVX2 or generic
+const char* elementKernelTarget();
+
+#endif  // RFDATA_ELEMENTKERNEL_H_
@@ -0,0 +1,138 @@
+#ifndef RFDATA_FASTMATH_H_
+#define RFDATA_FASTMATH_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "./util.h"
+
+// sin, cos and exp without branches, so that loops over many points vectorize, as in
+// elementRowKernel and delayTable.  They are accurate to a few units in the last place
+// over the ranges given.
+
+// adding and subtracting this rounds a double of magnitude below 2^51 to an integer
+const double roundingShift = 6755399441055744.0;  // 1.5*2^52
+
+inline double roundToInteger(double x) {
+    return (x + roundingShift) - roundingShift;
+}
+
+/*!  sin and cos of x, without branches so a loop of them vectorizes.  x is reduced by a
+ * multiple q of pi/2 in three parts (Cody and Waite), which is exact for |x| below about
+ * 1.6e6, far beyond the phases of a field buffer.  The polynomials are those of fdlibm.
+ */
+inline void sinCos(double x, double* sn, double* cs) {
+    const double pio2First = 1.57079632673412561417e+00;
+    const double pio2Second = 6.07710050630396597660e-11;
+    const double pio2Third = 2.02226624879595063154e-21;
+
+    double q = roundToInteger(x*M_2_PI);
+    double reduced = ((x - q*pio2First) - q*pio2Second) - q*pio2Third;
+    double z = reduced*reduced;
+
+    double sinR = reduced + reduced*z*(-1.66666666666666324348e-01
+                  + z*(8.33333333332248946124e-03 + z*(-1.98412698298579493134e-04
+                  + z*(2.75573137070700676789e-06 + z*(-2.50507602534068634195e-08
+                  + z*1.58969099521155010221e-10)))));
+    double cosR = 1 - 0.5*z + z*z*(4.16666666666666019037e-02
+                  + z*(-1.38888888888741095749e-03 + z*(2.48015872894767294178e-05
+                  + z*(-2.75573143513906633035e-07 + z*(2.08757232129817482790e-09
+                  - z*1.13596475577881948265e-11)))));
+
+    // q modulo 4, q/4 - 3/8 rounds to the whole number of turns
+    double quarter = q - 4*roundToInteger(0.25*q - 0.375);
+    bool odd = quarter == 1 || quarter == 3;
+    double s = odd ? cosR : sinR;
+    double c = odd ? sinR : cosR;
+    *sn = quarter >= 2 ? -s : s;
+    *cs = quarter == 1 || quarter == 2 ? -c : c;
+}
+
+/*!  exp(x) for x below 709, without branches.  x = n ln2 + r with |r| <= ln2/2, exp(r) is
+ * its Taylor series and 2^n is put together in the exponent bits.  Results that would be
+ * below the smallest normal double come out as about 1e-308 instead of less.
+ */
+inline double expNoBranch(double x) {
+    const double ln2High = 6.93147180369123816490e-01;
+    const double ln2Low = 1.90821492927058770002e-10;
+
+    x = std::max(x, -708.0);
+    double n = roundToInteger(x*M_LOG2E);
+    double r = (x - n*ln2High) - n*ln2Low;
+    double p = 1 + r*(1 + r*(1/2. + r*(1/6. + r*(1/24. + r*(1/120. + r*(1/720.
+               + r*(1/5040. + r*(1/40320. + r*(1/362880. + r*(1/3628800.
+               + r*(1/39916800. + r/479001600.)))))))))));
+
+    // the low bits of n + 1.5*2^52 are n in two's complement
+    double shifted = n + roundingShift;
+    int64_t bits, shiftBits;
+    memcpy(&bits, &shifted, sizeof(bits));
+    double shift = roundingShift;
+    memcpy(&shiftBits, &shift, sizeof(shiftBits));
+    int64_t scaleBits = (bits - shiftBits + 1023) << 52;
+    double scale;
+    memcpy(&scale, &scaleBits, sizeof(scale));
+    return p*scale;
+}
+
+// adding and subtracting this rounds a float of magnitude below 2^22 to an integer
+const float roundingShiftFloat = 12582912.0f;  // 1.5*2^23
+
+inline float roundToInteger(float x) {
+    return (x + roundingShiftFloat) - roundingShiftFloat;
+}
+
+/*!  sin and cos of x in single precision, the same way as sinCos but with the polynomials
+ * of the Cephes sinf and cosf, for |x| below about 1e4.
+ */
+inline void sinCos(float x, float* sn, float* cs) {
+    const float pio2First = 1.5703125f;
+    const float pio2Second = 4.837512969970703125e-4f;
+    const float pio2Third = 7.54978995489188216e-8f;
+
+    float q = roundToInteger(x*static_cast<float>(M_2_PI));
+    float reduced = ((x - q*pio2First) - q*pio2Second) - q*pio2Third;
+    float z = reduced*reduced;
+
+    float sinR = reduced + reduced*z*(-1.6666654611e-1f
+                 + z*(8.3321608736e-3f + z*-1.9515295891e-4f));
+    float cosR = 1 - 0.5f*z + z*z*(4.166664568298827e-2f
+                 + z*(-1.388731625493765e-3f + z*2.443315711809948e-5f));
+
+    float quarter = q - 4*roundToInteger(0.25f*q - 0.375f);
+    bool odd = quarter == 1 || quarter == 3;
+    float s = odd ? cosR : sinR;
+    float c = odd ? sinR : cosR;
+    *sn = quarter >= 2 ? -s : s;
+    *cs = quarter == 1 || quarter == 2 ? -c : c;
+}
+
+/*!  exp(x) in single precision for x below 88, as expNoBranch with the polynomial of the
+ * Cephes expf.  Results that would be below the smallest normal float come out as about
+ * 1e-38 instead of less.
+ */
+inline float expNoBranch(float x) {
+    const float ln2High = 0.693359375f;
+    const float ln2Low = -2.12194440e-4f;
+
+    x = std::max(x, -87.0f);
+    float n = roundToInteger(x*static_cast<float>(M_LOG2E));
+    float r = (x - n*ln2High) - n*ln2Low;
+    float p = 1 + r + r*r*(5.0000001201e-1f + r*(1.6666665459e-1f + r*(4.1665795894e-2f
+              + r*(8.3334519073e-3f + r*(1.3981999507e-3f + r*1.9875691500e-4f)))));
+
+    // the low bits of n + 1.5*2^23 are n in two's complement
+    float shifted = n + roundingShiftFloat;
+    int32_t bits, shiftBits;
+    memcpy(&bits, &shifted, sizeof(bits));
+    float shift = roundingShiftFloat;
+    memcpy(&shiftBits, &shift, sizeof(shiftBits));
+    int32_t scaleBits = (bits - shiftBits + 127) << 23;
+    float scale;
+    memcpy(&scale, &scaleBits, sizeof(scale));
+    return p*scale;
+}
+
+#endif  // RFDATA_FASTMATH_H_
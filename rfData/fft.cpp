@@ -0,0 +1,180 @@
+#include "./fft.h"
+
+#include <math.h>
+#include <assert.h>
+
+#include <algorithm>
+
+namespace {
+
+// largest prime factor done with a butterfly, longer lengths use Bluestein
+const int maxRadix = 13;
+
+}  // namespace
+
+/*!  Split n into radix 4, 2 and odd prime stages.  If a prime factor is too large for a
+ * butterfly, set up Bluestein's algorithm instead.
+ */
+fftPlan::fftPlan(size_t length): n(length), inner(NULL) {
+    assert(n > 0);
+
+    size_t left = n;
+    int p = 4;
+    while (left > 1) {
+        while (left % p) {
+            if (p == 4) p = 2;
+            else if (p == 2) p = 3;
+            else p += 2;
+            if (p > maxRadix) break;
+        }
+        if (p > maxRadix) break;
+        left /= p;
+        factors.push_back(p);
+        factors.push_back(static_cast<int>(left));
+    }
+
+    if (left == 1) {
+        twiddle.resize(n);
+        for (size_t k = 0; k < n; k++)
+            twiddle[k] = std::polar(1.0, -2*M_PI*k/n);
+        return;
+    }
+
+    factors.clear();
+    size_t m = 1;
+    while (m < 2*n - 1) m *= 2;
+    inner = new fftPlan(m);
+
+    // k^2 is taken modulo 2n so the angle stays accurate for long transforms
+    chirp.resize(n);
+    for (size_t k = 0; k < n; k++) {
+        size_t k2 = static_cast<size_t>((static_cast<unsigned long long>(k)*k) % (2*n));
+        chirp[k] = std::polar(1.0, -M_PI*k2/n);
+    }
+
+    filter.assign(m, cplxZero);
+    filter[0] = std::conj(chirp[0]);
+    for (size_t k = 1; k < n; k++)
+        filter[k] = filter[m-k] = std::conj(chirp[k]);
+    inner->transform(filter.data(), false);
+    for (size_t k = 0; k < m; k++)
+        filter[k] /= static_cast<double>(m);
+}
+
+fftPlan::~fftPlan() {
+    delete inner;
+}
+
+void fftPlan::transform(cplx* data, bool inverse) const {
+    if (!inverse) {
+        forward(data);
+        return;
+    }
+
+    // the inverse is the conjugate of the forward transform of the conjugate
+    for (size_t k = 0; k < n; k++)
+        data[k] = std::conj(data[k]);
+    forward(data);
+    for (size_t k = 0; k < n; k++)
+        data[k] = std::conj(data[k]);
+}
+
+void fftPlan::forward(cplx* data) const {
+    if (n == 1) return;
+    if (inner) {
+        bluestein(data);
+        return;
+    }
+
+    std::vector<cplx> in(data, data + n);
+    std::vector<cplx> scratch(maxRadix);
+    mixedRadix(data, in.data(), 1, factors.data(), scratch.data());
+}
+
+/*!  Decimation in time: transform the p interleaved subsequences of in, each of length m,
+ * into consecutive blocks of out, then combine them with a radix p butterfly.
+ */
+void fftPlan::mixedRadix(cplx* out, const cplx* in, size_t stride, const int* factor,
+                         cplx* scratch) const {
+    const int p = factor[0];
+    const int m = factor[1];
+
+    if (m == 1) {
+        for (int q = 0; q < p; q++)
+            out[q] = in[q*stride];
+    } else {
+        for (int q = 0; q < p; q++)
+            mixedRadix(out + q*m, in + q*stride, stride*p, factor + 2, scratch);
+    }
+
+    switch (p) {
+        case 2: butterfly2(out, stride, m); break;
+        case 4: butterfly4(out, stride, m); break;
+        default: butterflyGeneric(out, stride, m, p, scratch); break;
+    }
+}
+
+void fftPlan::butterfly2(cplx* out, size_t stride, int m) const {
+    for (int k = 0; k < m; k++) {
+        cplx t = out[k+m]*twiddle[k*stride];
+        out[k+m] = out[k] - t;
+        out[k] += t;
+    }
+}
+
+void fftPlan::butterfly4(cplx* out, size_t stride, int m) const {
+    for (int k = 0; k < m; k++) {
+        cplx s0 = out[k+m]*twiddle[k*stride];
+        cplx s1 = out[k+2*m]*twiddle[2*k*stride];
+        cplx s2 = out[k+3*m]*twiddle[3*k*stride];
+        cplx s5 = out[k] - s1;
+        cplx s6 = out[k] + s1;
+        cplx s3 = s0 + s2;
+        cplx s4 = (s0 - s2)*cplx(0, -1);
+
+        out[k] = s6 + s3;
+        out[k+2*m] = s6 - s3;
+        out[k+m] = s5 + s4;
+        out[k+3*m] = s5 - s4;
+    }
+}
+
+/*!  A plain DFT of length p across the blocks, with the twiddle for output k of input q
+ * being exp(-2 pi i qk/(pm)).
+ */
+void fftPlan::butterflyGeneric(cplx* out, size_t stride, int m, int p, cplx* scratch) const {
+    for (int u = 0; u < m; u++) {
+        for (int q = 0; q < p; q++)
+            scratch[q] = out[u + q*m];
+
+        for (int q1 = 0, k = u; q1 < p; q1++, k += m) {
+            size_t step = stride*k % n;
+            size_t at = 0;
+            cplx sum = scratch[0];
+            for (int q = 1; q < p; q++) {
+                at += step;
+                if (at >= n) at -= n;
+                sum += scratch[q]*twiddle[at];
+            }
+            out[k] = sum;
+        }
+    }
+}
+
+/*!  X_k = w_k sum_j (x_j w_j) conj(w_{k-j}) with w_k = exp(-pi i k^2/n), a convolution done
+ * with the power of two inner transform.
+ */
+void fftPlan::bluestein(cplx* data) const {
+    size_t m = inner->size();
+    std::vector<cplx> work(m, cplxZero);
+    for (size_t k = 0; k < n; k++)
+        work[k] = data[k]*chirp[k];
+
+    inner->transform(work.data(), false);
+    for (size_t k = 0; k < m; k++)
+        work[k] *= filter[k];
+    inner->transform(work.data(), true);
+
+    for (size_t k = 0; k < n; k++)
+        data[k] = work[k]*chirp[k];
+}
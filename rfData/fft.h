@@ -0,0 +1,52 @@
+#ifndef RFDATA_FFT_H_
+#define RFDATA_FFT_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "./util.h"
+
+/*! \brief A discrete Fourier transform of one fixed length.
+ *
+ * Lengths made of small prime factors are transformed by a mixed radix Cooley-Tukey
+ * algorithm, with special butterflies for factors of 4 and 2.  Lengths with a prime factor
+ * larger than maxRadix use Bluestein's algorithm, which turns the transform into a
+ * convolution done with power of two transforms.  Either way the cost is O(n log n).
+ *
+ * The plan holds only tables, so one plan can be used by several threads at once.
+ */
+class fftPlan {
+ public:
+  explicit fftPlan(size_t n);
+  ~fftPlan();
+
+  size_t size() const { return n; }
+
+  // transform data in place, forward is sum x[j] exp(-2 pi i jk/n) and
+  // inverse the same with exp(+...).  Neither is scaled.
+  void transform(cplx* data, bool inverse) const;
+
+ private:
+  size_t n;
+  std::vector<cplx> twiddle;  // exp(-2 pi i k/n)
+  std::vector<int> factors;   // radix, then the length left, for each stage
+
+  // Bluestein's algorithm, NULL for mixed radix lengths
+  fftPlan* inner;             // power of two transform of at least 2n-1
+  std::vector<cplx> chirp;    // exp(-pi i k^2/n)
+  std::vector<cplx> filter;   // forward transform of the conjugate chirp, scaled
+
+  fftPlan(const fftPlan&);
+  fftPlan& operator=(const fftPlan&);
+
+  void forward(cplx* data) const;
+  void mixedRadix(cplx* out, const cplx* in, size_t stride, const int* factor,
+                  cplx* scratch) const;
+  void butterfly2(cplx* out, size_t stride, int m) const;
+  void butterfly4(cplx* out, size_t stride, int m) const;
+  void butterflyGeneric(cplx* out, size_t stride, int m, int p, cplx* scratch) const;
+  void bluestein(cplx* data) const;
+};
+
+#endif  // RFDATA_FFT_H_
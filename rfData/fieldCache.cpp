@@ -0,0 +1,167 @@
+#include "./fieldCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char cacheMagic[8] = {'U', 'S', 'F', 'I', 'E', 'L', 'D', '\0'};
+const uint32_t cacheVersion = 1;
+const uint32_t endianMark = 0x01020304;
+
+/*! \brief The header at the start of every cache file, 64 bytes so the buffer after it stays
+ * aligned for any vector instructions.
+ */
+struct cacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;      // endianMark as written by the machine that wrote it
+    uint64_t hash;        // fieldBuffer::configurationHash
+    uint64_t count;       // number of values in the buffer
+    double freq;          // frequency in Hz, for information only
+    uint32_t valueBytes;  // size of one value
+    char reserved[20];
+};
+
+static_assert(sizeof(cacheHeader) == 64, "cache header must be 64 bytes");
+
+bool headerMatches(const cacheHeader& header, uint64_t hash, uint64_t count,
+                   size_t valueBytes) {
+    return memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+           header.version == cacheVersion &&
+           header.endian == endianMark &&
+           header.hash == hash &&
+           header.count == count &&
+           header.valueBytes == valueBytes;
+}
+
+int processId() {
+#ifdef _WIN32
+    return _getpid();
+#else
+    return getpid();
+#endif
+}
+
+}  // namespace
+
+fieldCache::fieldCache(const std::string& dir): directory(dir) {
+#ifdef _WIN32
+    _mkdir(directory.c_str());
+#else
+    mkdir(directory.c_str(), 0777);
+#endif
+    cout << "Using field buffer cache in " << directory << endl;
+}
+
+std::string fieldCache::fileName(uint64_t hash) {
+    std::ostringstream name;
+    name << directory << "/field_" << std::hex << hash << ".bin";
+    return name.str();
+}
+
+/*!  Look for the buffer of frequency freq in the cache, and copy it into the buffer of
+ * pressure if it is there.  Files that do not match the configuration exactly are ignored.
+ */
+bool fieldCache::load(fieldBuffer* pressure, double freq) {
+    // the buffer is laid out, and allocated, for the grid of freq
+    pressure->setFrequency(freq);
+    uint64_t hash = pressure->configurationHash(freq);
+    uint64_t count = pressure->bufferSize();
+    size_t valueBytes = pressure->bufferValueBytes();
+    std::string name = fileName(hash);
+    size_t fileSize = sizeof(cacheHeader) + count*valueBytes;
+
+#ifdef _WIN32
+    std::ifstream fpin(name.c_str(), std::ios::binary);
+    if (!fpin.is_open()) return false;
+
+    cacheHeader header;
+    fpin.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!fpin || !headerMatches(header, hash, count, valueBytes)) return false;
+
+    fpin.read(reinterpret_cast<char*>(pressure->buffer()), count*valueBytes);
+    if (!fpin) return false;
+#else
+    int fd = open(name.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) != fileSize) {
+        close(fd);
+        return false;
+    }
+
+    void* mapped = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const cacheHeader* header = static_cast<const cacheHeader*>(mapped);
+    bool matches = headerMatches(*header, hash, count, valueBytes);
+    if (matches) {
+        memcpy(pressure->buffer(),
+               static_cast<const char*>(mapped) + sizeof(cacheHeader),
+               count*valueBytes);
+    }
+    munmap(mapped, fileSize);
+    if (!matches) return false;
+#endif
+
+    return true;
+}
+
+/*!  Write the buffer of pressure to the cache.  A failure to write only costs the time of
+ * recalculating the buffer later, so it is reported but not fatal.
+ */
+void fieldCache::store(fieldBuffer* pressure, double freq) {
+    static std::atomic<int> fileCounter(0);
+
+    uint64_t hash = pressure->configurationHash(freq);
+    std::string name = fileName(hash);
+
+    std::ostringstream tmpName;
+    tmpName << name << ".tmp" << processId() << '_' << fileCounter++;
+
+    cacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.endian = endianMark;
+    header.hash = hash;
+    header.count = pressure->bufferSize();
+    header.freq = freq;
+    header.valueBytes = static_cast<uint32_t>(pressure->bufferValueBytes());
+
+    std::ofstream fpout(tmpName.str().c_str(), std::ios::binary);
+    if (!fpout.is_open()) {
+        cout << "Unable to write field cache file " << tmpName.str() << endl;
+        return;
+    }
+    fpout.write(reinterpret_cast<char*>(&header), sizeof(header));
+    fpout.write(reinterpret_cast<char*>(pressure->buffer()),
+                header.count*header.valueBytes);
+    fpout.close();
+
+    if (!fpout || rename(tmpName.str().c_str(), name.c_str()) != 0) {
+        cout << "Unable to write field cache file " << name << endl;
+        remove(tmpName.str().c_str());
+    }
+}
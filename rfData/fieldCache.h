@@ -0,0 +1,38 @@
+#ifndef RFDATA_FIELDCACHE_H_
+#define RFDATA_FIELDCACHE_H_
+
+#include <stdint.h>
+
+#include <string>
+
+#include "./pressureField.h"
+
+/*! \brief An on-disk cache of calculated field buffers, shared between rfDataProgram runs.
+ *
+ * A field buffer depends only on the transducer, the grid, the focus and the wavenumber in
+ * the phantom, not on where the scatterers are.  Imaging a pre- and a post-compression
+ * phantom with the same settings therefore needs the same buffers, and the second run can
+ * read them instead of calculating them.
+ *
+ * Each buffer is one file named after fieldBuffer::configurationHash, holding a 64 byte
+ * header and then the buffer exactly as it is laid out in memory, so the file can be mapped
+ * straight into memory.  Files are written under a temporary name and renamed when
+ * complete, so several threads or processes can share a cache directory.
+ */
+class fieldCache {
+ public:
+  explicit fieldCache(const std::string& dir);
+
+  // fill the buffer of pressure at frequency freq from the cache,
+  // returns false if it is not there
+  bool load(fieldBuffer* pressure, double freq);
+
+  // save the buffer of pressure, which has been calculated at frequency freq
+  void store(fieldBuffer* pressure, double freq);
+
+ private:
+  std::string directory;
+  std::string fileName(uint64_t hash);
+};
+
+#endif  // RFDATA_FIELDCACHE_H_
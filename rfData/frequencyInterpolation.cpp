@@ -0,0 +1,98 @@
+#include "./frequencyInterpolation.h"
+
+#include <math.h>
+#include <assert.h>
+
+frequencyInterpolator::frequencyInterpolator(fieldBuffer* p)
+    : pressure(p) {
+}
+
+void frequencyInterpolator::keep(double freq) {
+    pressure->setFrequency(freq);
+    pressure->axialPhases(&phase);
+    int depths = pressure->giveDepthPoints();
+
+    std::vector<cplxFloat>& anchor = anchors[freq];
+    anchor.resize(pressure->bufferSize());
+    for (size_t line = 0; line < anchor.size(); line += depths) {
+        for (int z = 0; z < depths; z++)
+            anchor[line + z] = cplxFloat(pressure->bufferValue(line + z)/phase[z]);
+    }
+}
+
+void frequencyInterpolator::release(double freq) {
+    anchors.erase(freq);
+}
+
+void frequencyInterpolator::lagrangeWeights(double freq, const std::vector<double>& through,
+                                            std::vector<double>* weights,
+                                            std::vector<const cplxFloat*>* values) {
+    weights->assign(through.size(), 1.0);
+    values->resize(through.size());
+    for (size_t i = 0; i < through.size(); i++) {
+        assert(anchors.count(through[i]) == 1);
+        (*values)[i] = anchors[through[i]].data();
+        for (size_t j = 0; j < through.size(); j++) {
+            if (j != i)
+                (*weights)[i] *= (freq - through[j])/(through[i] - through[j]);
+        }
+    }
+}
+
+void frequencyInterpolator::interpolate(double freq, const std::vector<double>& through) {
+    std::vector<double> weights;
+    std::vector<const cplxFloat*> values;
+    lagrangeWeights(freq, through, &weights, &values);
+
+    pressure->setFrequency(freq);
+    pressure->axialPhases(&phase);
+    int depths = pressure->giveDepthPoints();
+    size_t count = pressure->bufferSize();
+
+    for (size_t line = 0; line < count; line += depths) {
+        for (int z = 0; z < depths; z++) {
+            cplx sum = cplxZero;
+            for (size_t i = 0; i < weights.size(); i++)
+                sum += weights[i]*cplx(values[i][line + z]);
+            pressure->setBufferValue(line + z, sum*phase[z]);
+        }
+    }
+}
+
+/*!  Each depth is compared on its own and the relative errors of the depths inside the
+ * phantom averaged, so the weak field deep down and off the focus counts as much as the
+ * focal zone, as it does in an image with time gain compensation.
+ */
+double frequencyInterpolator::error(double freq, const std::vector<double>& through) {
+    std::vector<double> weights;
+    std::vector<const cplxFloat*> values;
+    lagrangeWeights(freq, through, &weights, &values);
+
+    pressure->setFrequency(freq);
+    pressure->axialPhases(&phase);
+    int depths = pressure->giveDepthPoints();
+    size_t count = pressure->bufferSize();
+    int first, last;
+    pressure->phantomDepths(&first, &last);
+
+    std::vector<double> errorSquares(depths, 0.0), referenceSquares(depths, 0.0);
+    for (size_t line = 0; line < count; line += depths) {
+        for (int z = first; z <= last; z++) {
+            cplx sum = cplxZero;
+            for (size_t i = 0; i < weights.size(); i++)
+                sum += weights[i]*cplx(values[i][line + z]);
+            cplx exact = pressure->bufferValue(line + z);
+            errorSquares[z] += std::norm(sum*phase[z] - exact);
+            referenceSquares[z] += std::norm(exact);
+        }
+    }
+
+    double relativeSquares = 0;
+    int compared = 0;
+    for (int z = first; z <= last; z++) {
+        if (referenceSquares[z] == 0) continue;
+        relativeSquares += errorSquares[z]/referenceSquares[z];
+        compared++;
+    }
+    return compared > 0 ? sqrt(relativeSquares/compared) : 0;
+}
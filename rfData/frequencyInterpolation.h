@@ -0,0 +1,50 @@
+#ifndef RFDATA_FREQUENCYINTERPOLATION_H_
+#define RFDATA_FREQUENCYINTERPOLATION_H_
+
+#include <map>
+#include <vector>
+
+#include "./pressureField.h"
+#include "./util.h"
+
+/*! \brief Field buffers at frequencies between calculated ones, by interpolating in
+ * frequency.
+ *
+ * From one frequency bin to the next the round trip phase to a depth z, 2kz, changes by up
+ * to a whole cycle, but with exp(2iKz) taken out the field changes very little.  The buffers
+ * calculated at a few anchor frequencies are kept with that factor removed, in single
+ * precision, and the buffer at any other frequency is the Lagrange polynomial through the
+ * anchors, times exp(2iKz) at that frequency.
+ *
+ * Each interpolator fills the buffer of its own fieldBuffer, so one can't be used by two
+ * threads at once.
+ */
+class frequencyInterpolator {
+ public:
+  explicit frequencyInterpolator(fieldBuffer* pressure);
+
+  // keep the buffer of pressure, calculated at frequency freq, as an anchor
+  void keep(double freq);
+  void release(double freq);
+  void clear() { anchors.clear(); }
+
+  // fill the buffer of pressure at frequency freq from the anchors at the
+  // frequencies in through, which must all be kept
+  void interpolate(double freq, const std::vector<double>& through);
+
+  // relative RMS difference between the buffer of pressure, calculated at
+  // frequency freq, and the interpolation through the anchors, over the
+  // depths of the phantom
+  double error(double freq, const std::vector<double>& through);
+
+ private:
+  fieldBuffer* pressure;
+  std::map<double, std::vector<cplxFloat> > anchors;
+  std::vector<cplx> phase;  // exp(2iKz) of each depth at the last frequency
+
+  void lagrangeWeights(double freq, const std::vector<double>& through,
+                       std::vector<double>* weights,
+                       std::vector<const cplxFloat*>* values);
+};
+
+#endif  // RFDATA_FREQUENCYINTERPOLATION_H_
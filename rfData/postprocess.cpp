@@ -0,0 +1,139 @@
+#include "./postprocess.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "./fft.h"
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char imageMagic[8] = {'U', 'S', 'I', 'M', 'A', 'G', 'E', '\0'};
+const uint32_t imageVersion = 1;
+const uint32_t endianMark = 0x01020304;
+
+}  // namespace
+
+static_assert(sizeof(imageFileHeader) == 64, "image header must be 64 bytes");
+
+rfImage::rfImage(int points, int lines, double step, int upsample)
+    : freqPoints(points),
+      beamlines(lines),
+      freqStep(step),
+      sampleCount(points*upsample),
+      rate(step*points*upsample),
+      frames(0)
+{}
+
+/*!  Each thread claims beamlines one at a time and transforms them with its own work array,
+ * the plan is shared.
+ */
+void rfImage::addFrame(const cplx* coef, const transducerSpectrum& spectrum, int threads) {
+    size_t frameSamples = static_cast<size_t>(sampleCount)*beamlines;
+    size_t first = rf.size();
+    rf.resize(first + frameSamples);
+    envelope.resize(first + frameSamples);
+    frames++;
+
+    // the weights and the scale of the inverse transform are the same for every line
+    std::vector<double> weight(freqPoints, 1.0/sampleCount);
+    if (spectrum.isSet()) {
+        for (int k = 0; k < freqPoints; k++)
+            weight[k] *= spectrum.magnitude(k*freqStep);
+    }
+
+    fftPlan plan(sampleCount);
+    std::atomic<int> nextLine(0);
+    auto work = [&]() {
+        std::vector<cplx> line(sampleCount);
+        for (;;) {
+            int l = nextLine++;
+            if (l >= beamlines) return;
+
+            const cplx* lineCoef = coef + static_cast<size_t>(l)*freqPoints;
+            for (int k = 0; k < freqPoints; k++)
+                line[k] = std::conj(lineCoef[k])*weight[k];
+            std::fill(line.begin() + freqPoints, line.end(), cplxZero);
+
+            plan.transform(line.data(), true);
+
+            float* lineRf = &rf[first + static_cast<size_t>(l)*sampleCount];
+            float* lineEnvelope = &envelope[first + static_cast<size_t>(l)*sampleCount];
+            for (int s = 0; s < sampleCount; s++) {
+                lineRf[s] = static_cast<float>(line[s].real());
+                lineEnvelope[s] = static_cast<float>(std::abs(line[s]));
+            }
+        }
+    };
+
+    threads = std::max(1, std::min(threads, beamlines));
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++)
+        workers.push_back(std::thread(work));
+    work();
+    for (size_t t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+int rfImage::writeRf(const char* filename) const {
+    return writeFile(filename, rfLineImage, 0, rf.data(), sizeof(float));
+}
+
+/*!  Log compress the envelopes against the brightest point of all frames, so frames can be
+ * compared with each other.
+ */
+int rfImage::writeBmode(const char* filename, double dynamicRangeDb) const {
+    float peak = 0;
+    for (size_t i = 0; i < envelope.size(); i++)
+        peak = std::max(peak, envelope[i]);
+
+    std::vector<uint8_t> bmode(envelope.size(), 0);
+    if (peak > 0) {
+        for (size_t i = 0; i < envelope.size(); i++) {
+            if (envelope[i] <= 0) continue;
+            double db = 20*log10(envelope[i]/peak);
+            double level = 255*(1 + db/dynamicRangeDb);
+            bmode[i] = static_cast<uint8_t>(std::min(255.0, std::max(0.0, floor(level + 0.5))));
+        }
+    }
+    return writeFile(filename, bmodeImage, dynamicRangeDb, bmode.data(), sizeof(uint8_t));
+}
+
+int rfImage::writeFile(const char* filename, imageFileType type, double dynamicRange,
+                       const void* data, size_t valueBytes) const {
+    std::ofstream fpout(filename, std::ios::binary);
+    if (!fpout.is_open()) {
+        cout << "Failure to write image file named: " << filename << endl;
+        return 0;
+    }
+
+    imageFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, imageMagic, sizeof(imageMagic));
+    header.version = imageVersion;
+    header.endian = endianMark;
+    header.type = type;
+    header.samples = sampleCount;
+    header.beamlines = beamlines;
+    header.frames = frames;
+    header.sampleRate = rate;
+    header.dynamicRange = dynamicRange;
+
+    fpout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fpout.write(static_cast<const char*>(data),
+                static_cast<std::streamsize>(valueBytes*sampleCount*beamlines*frames));
+    fpout.close();
+    if (!fpout) {
+        cout << "Error writing image file " << filename << endl;
+        return 0;
+    }
+    return 1;
+}
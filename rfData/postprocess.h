@@ -0,0 +1,71 @@
+#ifndef RFDATA_POSTPROCESS_H_
+#define RFDATA_POSTPROCESS_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "./spectrum.h"
+#include "./util.h"
+
+/*! \brief The header of an RF line or B-mode image file written by rfImage.
+ *
+ * The header is followed by frames x beamlines x samples values, the sample index changing
+ * fastest: floats for RF lines, bytes for B-mode images where 0 is dynamicRange dB or more
+ * below the brightest point of all frames and 255 is the brightest point.
+ */
+struct imageFileHeader {
+    char magic[8];         // "USIMAGE" and a terminating zero
+    uint32_t version;
+    uint32_t endian;       // 0x01020304 as written by the machine that wrote it
+    uint32_t type;         // imageFileType
+    uint32_t samples;      // time samples per beamline
+    uint32_t beamlines;
+    uint32_t frames;
+    double sampleRate;     // Hz
+    double dynamicRange;   // dB, B-mode images only
+    char reserved[16];
+};
+
+enum imageFileType {
+    rfLineImage = 0,
+    bmodeImage = 1
+};
+
+/*! \brief Time domain RF lines and their envelopes, made from the simulated spectra.
+ *
+ * This is what binary2matrix.m does: each beamline's spectrum is conjugated, weighted by the
+ * transducer spectrum, zero padded to upsample times its length and inverse transformed.
+ * Only positive frequencies are simulated, so the result is the analytic signal: its real
+ * part is the RF line and its magnitude the envelope.  Beamlines are shared out over threads.
+ */
+class rfImage {
+ public:
+  rfImage(int freqPoints, int beamlines, double freqStep, int upsample);
+
+  // transform the freqPoints x beamlines coefficients of one frame, weighting
+  // them by spectrum if it is set
+  void addFrame(const cplx* coef, const transducerSpectrum& spectrum, int threads);
+
+  int samples() const { return sampleCount; }
+  double sampleRate() const { return rate; }
+
+  // write the RF lines or the log compressed envelopes, return 1 on success
+  int writeRf(const char* filename) const;
+  int writeBmode(const char* filename, double dynamicRangeDb) const;
+
+ private:
+  int freqPoints;
+  int beamlines;
+  double freqStep;
+  int sampleCount;
+  double rate;
+  int frames;
+  std::vector<float> rf;
+  std::vector<float> envelope;
+
+  int writeFile(const char* filename, imageFileType type, double dynamicRange,
+                const void* data, size_t valueBytes) const;
+};
+
+#endif  // RFDATA_POSTPROCESS_H_
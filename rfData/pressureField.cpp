@@ -6,8 +6,10 @@
 #include <assert.h>
 #include <memory.h>
 
+#include <algorithm>
 #include <iostream>
 
+#include "./fastMath.h"
 #include "./util.h"
 #include "./phantom.h"
 
@@ -24,13 +26,12 @@ array::array(singleGeom g, double s, int eCnt, double speed):
     eleCnt(eCnt),
     assumedSoundSpeed(speed) {
     int i;
-    // default value for F num = 2
+    // all elements active, with equal weights
     trnsFnum = -2;
     recvFnum = -2;
-    if (trnsFnum < 0)
-        cout << "trnsFnum<0, so using all elements!" << endl;
-    if (recvFnum < 0)
-        cout << "recvFnum<0, so using all elements!" << endl;
+    trnsWindow = rectWindow;
+    recvWindow = rectWindow;
+    tukeyTaper = 0.5;
 
     geom = g;
 
@@ -52,62 +53,27 @@ array::array(singleGeom g, double s, int eCnt, double speed):
 /*!setup transmit focus
  */
 void array::setTransFocus(double focus, double F, double freq) {
-    setFocus(transPhase, focus, F, freq);
+    setFocus(transPhase, focus, F, trnsWindow, freq);
 }
 
 /*!setup receive focus
  */
 void array::setRecFocus(double focus, double F, double freq) {
-    setFocus(recPhase, focus, F, freq);
+    setFocus(recPhase, focus, F, recvWindow, freq);
 }
 
 
 /*!  Set up either transmit or receive phase on an array
  *   If an element is off, for a given aperture the phase factor
  *   will be equal to a complex zero, canceling that contribution.
+ *   The delays and weights are those of a delayTable with the one focus.
  */
-void array::setFocus(cplx* phase, double focus, double F, double freq) {
-    cplx iOmega = imUnit*(2*M_PI*freq);
-    double timeDelay;
-
-    // to focus to infinity
-    if (focus <= 0) {
-        for (int i = 0; i < eleCnt; i++) {
-            timeDelay = 0;
-            phase[i] = exp(iOmega*timeDelay);
-        }
-        return;
-    }
-
-    int eleActive = static_cast<int>(focus/(F*spacing));
-
-    // make sure the element number is even, and that the number of
-    // txdcer elements is not exceeded
-    if (eleActive%2 == 1) eleActive++;
-
-    // get the number of active elements according to the F number,
-    // if F<0 activate all
-    if (eleActive < 1 || eleActive > eleCnt)
-        eleActive = eleCnt;
-
-
-    int firstElement = (eleCnt - eleActive)/2;
-    int lastElement = firstElement + eleActive;
-
-    int i;
-    for (i=0; i < firstElement; i++)
-        phase[i] = cplxZero;
-
-    // setup lateral phase factor
-    for (i=firstElement; i < lastElement; i++) {
-        double xLoc = (i-(eleCnt-1)/2.)*spacing;
-        double timeDelay = (focus - sqrt((xLoc*xLoc) + focus*focus)) /
-                                                           assumedSoundSpeed;
-        phase[i] = exp(iOmega*timeDelay);
-    }
-
-    for (i=lastElement; i < eleCnt; i++)
-        phase[i] = cplxZero;
+void array::setFocus(cplx* phase, double focus, double F, apodizationWindow window,
+                     double freq) {
+    delayTable table(eleCnt, spacing, assumedSoundSpeed);
+    table.setAperture(F, window, tukeyTaper);
+    table.setFoci(std::vector<double>(1, focus));
+    table.phases(0, freq, phase);
 }
 
 void array::setTrsFnum(double Fnum) {
@@ -140,6 +106,8 @@ fieldBuffer::fieldBuffer(double f,
     : transFocus(f),
       step(sp),
       K(cplxZero),
+      zStepPhase(cplxOne),
+      interpolation(nearestPoint),
       target(ph),
       arrayLineSize(0),
       arrayPlaneSize(0),
@@ -180,30 +148,192 @@ fieldBuffer::fieldBuffer(double f,
     if (yLen%2 == 0) yLen++;
     if (zLen%2 == 0) zLen++;
 
-    xLenExtra = xLen + denseFactor*(transducer->eleCnt-1);
+    // the grid above is the finest, coarser ones are chosen per frequency
+    pointsPerWavelength = 0;
+    grid.x = grid.y = grid.z = 1;
+    fineStep = step;
+    fineXLen = xLen;
+    fineYLen = yLen;
+    fineZLen = zLen;
+    fineDenseFactor = denseFactor;
+
+    singleRowTransField = NULL;
+    singleRowRecField = NULL;
+    singleRowX = NULL;
+    rowKernel = NULL;
+    superposition = NULL;
+    fftRowsBefore = directRowsBefore = 0;
+    rowTransSum = NULL;
+    rowRecSum = NULL;
+    transDelays = NULL;
+    recDelays = NULL;
+    engine = fresnelEngine;
+    spectrum = NULL;
+    planeTransField = NULL;
+    planeRecField = NULL;
+    arrayField = NULL;
+    arrayFieldFloat = NULL;
+    bufferAllocated = 0;
+    precision = doublePrecision;
+    keepDouble = false;
+    layoutGrid();
+}
+
+/*!Set up the current grid from grid and the finest grid: its steps and dimensions, the rows
+ * of single element fields.  Each axis keeps at least the extent of the finest grid.  The
+ * focusing delays and the angular spectrum engine depend on the grid too, and are worked out
+ * again when next needed.
+ */
+void fieldBuffer::layoutGrid() {
+    step.x = fineStep.x*grid.x;
+    step.y = fineStep.y*grid.y;
+    step.z = fineStep.z*grid.z;
+    xLen = 2*((fineXLen/2 + grid.x - 1)/grid.x) + 1;
+    yLen = 2*((fineYLen/2 + grid.y - 1)/grid.y) + 1;
+    zLen = 2*((fineZLen/2 + grid.z - 1)/grid.z) + 1;
+    denseFactor = fineDenseFactor/grid.x;
+    assert(denseFactor*grid.x == fineDenseFactor);
 
+    xLenExtra = xLen + denseFactor*(transducer->eleCnt-1);
 
     // allocate space
+    delete[] singleRowTransField;
     singleRowTransField = new cplx[xLenExtra];
     assert(singleRowTransField != NULL);
 
+    delete[] singleRowRecField;
     singleRowRecField = new cplx[xLenExtra];
     assert(singleRowRecField != NULL);
 
+    // the rows are symmetric, so only x <= 0 is calculated
+    int halfRow = (xLenExtra+1)/2;
+    delete[] singleRowX;
+    singleRowX = new double[halfRow];
+    for (int i = 0; i < halfRow; i++)
+        singleRowX[i] = (i - (xLenExtra-1)/2)*step.x;
+    delete rowKernel;
+    rowKernel = new elementRowKernel(halfRow);
+
+    superpositionMode mode = automaticSum;
+    if (superposition) {
+        mode = superposition->giveMode();
+        fftRowsBefore += superposition->fftRows();
+        directRowsBefore += superposition->directRows();
+        delete superposition;
+    }
+    superposition = new elementSuperposition(xLenExtra, (xLen+1)/2, denseFactor,
+                                             transducer->eleCnt);
+    superposition->setMode(mode);
+    delete[] rowTransSum;
+    delete[] rowRecSum;
+    rowTransSum = new cplx[(xLen+1)/2];
+    rowRecSum = new cplx[(xLen+1)/2];
+
+    delete transDelays;
+    delete recDelays;
+    transDelays = NULL;
+    recDelays = NULL;
+    delete spectrum;
+    delete[] planeTransField;
+    delete[] planeRecField;
+    spectrum = NULL;
+    planeTransField = NULL;
+    planeRecField = NULL;
+
     arrayPlaneSize = zLen*(yLen+1)/2;
+}
 
-    arrayField = new cplx[(xLen)*arrayPlaneSize];
-    assert(arrayField != NULL);
+/*!The grid of the buffer at frequency freq: along each axis the coarsest one, by a power of
+ * two, whose step is at most a pointsPerWavelength-th of the wavelength in the phantom.
+ * Laterally the element spacing stays a whole number of steps.  Axially the step stays below
+ * the phantom gap, so no scatterer falls in a cell reaching the face of the transducer,
+ * where the field is singular.
+ */
+gridFactors fieldBuffer::gridFor(double freq) {
+    gridFactors g;
+    g.x = g.y = g.z = 1;
+    if (pointsPerWavelength <= 0 || freq <= 0) return g;
+
+    double wanted = target->soundSpeed()/freq/pointsPerWavelength;
+    while (fineDenseFactor%(2*g.x) == 0 && 2*g.x*fineStep.x <= wanted) g.x *= 2;
+    while (2*g.y*fineStep.y <= wanted && 2*g.y <= fineYLen/2) g.y *= 2;
+    while (2*g.z*fineStep.z <= wanted && 2*g.z*fineStep.z < phantomGap &&
+           2*g.z <= fineZLen/2) g.z *= 2;
+    return g;
+}
+
+void fieldBuffer::useGrid(const gridFactors& g) {
+    if (g == grid) return;
+    grid = g;
+    layoutGrid();
 }
 
 // destructor
 fieldBuffer::~fieldBuffer() {
     delete[] singleRowTransField;
     delete[] singleRowRecField;
+    delete[] singleRowX;
+    delete rowKernel;
+    delete superposition;
+    delete transDelays;
+    delete recDelays;
+    delete spectrum;
+    delete[] planeTransField;
+    delete[] planeRecField;
+    delete[] rowTransSum;
+    delete[] rowRecSum;
     delete[] arrayField;
+    delete[] arrayFieldFloat;
     delete fres;
 }
 
+/*!Choose how the buffer is stored, see fieldPrecision.  Call before the buffer is first
+ * calculated or loaded.
+ */
+void fieldBuffer::setPrecision(fieldPrecision p, bool keep) {
+    precision = p;
+    keepDouble = keep;
+    delete[] arrayField;
+    delete[] arrayFieldFloat;
+    arrayField = NULL;
+    arrayFieldFloat = NULL;
+    bufferAllocated = 0;
+}
+
+/*!Allocate the buffer for the current grid, unless it already is.  The buffer is only
+ * allocated here, when a frequency is set, so a buffer is never held at a grid no frequency
+ * was imaged on.
+ */
+void fieldBuffer::allocateBuffer() {
+    if (bufferAllocated == bufferSize()) return;
+    delete[] arrayField;
+    delete[] arrayFieldFloat;
+    bufferAllocated = bufferSize();
+    bool wantDouble = precision == doublePrecision || keepDouble;
+    bool wantFloat = precision == singlePrecision;
+    arrayField = wantDouble ? new cplx[bufferAllocated] : NULL;
+    arrayFieldFloat = wantFloat ? new cplxFloat[bufferAllocated] : NULL;
+}
+
+void* fieldBuffer::buffer() {
+    if (precision == singlePrecision) return arrayFieldFloat;
+    return arrayField;
+}
+
+size_t fieldBuffer::bufferValueBytes() {
+    return precision == singlePrecision ? sizeof(cplxFloat) : sizeof(cplx);
+}
+
+cplx fieldBuffer::doubleField(const fieldSample& sample, const cellFraction* fraction) {
+    assert(arrayField != NULL);
+    fieldPrecision kept = precision;
+    precision = doublePrecision;
+    cplx value = interpolation == nearestPoint ? bufferField(sample)
+                                               : directInterpolatedField(sample, *fraction);
+    precision = kept;
+    return value;
+}
+
 /*!Calculate pressure field from a single rectangular element by accurate approximation
  */
 cplx fieldBuffer::getSingleElementField(const vector& fieldPoint,
@@ -227,12 +357,12 @@ cplx fieldBuffer::getSingleElementField(const vector& fieldPoint,
     double argY = (k*fieldPoint.y*b)/(2*M_PI*r);
     double sincX, sincY;
 
-    if (argX < 1E-8)
+    if (fabs(argX) < 1E-8)
         sincX  = 1.;
     else
         sincX = sin(argX)/argX;
 
-    if (argY < 1E-8)
+    if (fabs(argY) < 1E-8)
         sincY = 1.;
     else
         sincY = sin(argY)/argY;
@@ -268,90 +398,270 @@ cplx fieldBuffer::getSingleElementField(const vector& fieldPoint,
     return integral;
 }
 
-/*!Calculate the field seen by the transducer at each location.
- * This field is the product of incident and reflected sound at each location
+/*!Set the complex wavenumber used by bufferField for frequency freq, and make the grid of
+ * that frequency the current one
  */
-void fieldBuffer::calculateBufferField(double freq) {
-    // setup frequency
+void fieldBuffer::setFrequency(double freq) {
+    useGrid(gridFor(freq));
+    allocateBuffer();
     K = 2*M_PI*freq/target->soundSpeed() + imUnit*target->attenuation(freq);
     assert(K.real() != 0);
+    zStepPhase = exp(-2.*step.z*imUnit*K);
+    KFloat = cplxFloat(K);
+}
 
-    vector loc;
+/*!The round trip propagation to each depth at the frequency last set, exp(2iKz), with
+ * the attenuation in the imaginary part of K
+ */
+void fieldBuffer::axialPhases(std::vector<cplx>* phase) {
+    phase->resize(zLen);
+    for (int zIndex=-(zLen-1)/2; zIndex <=(zLen-1)/2; zIndex++) {
+        double z = zIndex*step.z + center.z;
+        (*phase)[zIndex + (zLen-1)/2] = exp(2.*z*imUnit*K);
+    }
+}
 
-    singleGeom perfectTrans, perfectRec;
-    perfectRec = transducer->geom;
-    perfectTrans = transducer->geom;
+void fieldBuffer::phantomDepths(int* first, int* last) {
+    double top = center.z - (zLen-1)/2*step.z;
+    *first = std::max(0, static_cast<int>(ceil((phantomGap - top)/step.z)));
+    *last = std::min(zLen - 1, static_cast<int>(floor((size.z - phantomGap - top)/step.z)));
+}
+
+/*!Image the depths of each zone with its own transmit focus.  Zones change halfway between
+ * consecutive foci.  A single focus is one zone covering every depth, in place of the focus
+ * given to the constructor, and an empty list goes back to that focus.
+ */
+void fieldBuffer::setTransmitZones(const std::vector<double>& foci) {
+    transZoneFoci.clear();
+    delete transDelays;
+    transDelays = NULL;
+    if (foci.empty()) return;
+
+    transZoneFoci = foci;
+    std::sort(transZoneFoci.begin(), transZoneFoci.end());
+}
+
+int fieldBuffer::transmitZone(double depth) {
+    int zone = 0;
+    while (zone + 1 < static_cast<int>(transZoneFoci.size()) &&
+           depth >= (transZoneFoci[zone] + transZoneFoci[zone+1])/2)
+        zone++;
+    return zone;
+}
+
+/*!Hash everything that the buffer calculated by calculateBufferField(freq) depends on: the
+ * transducer, the focus, the grid and the wavenumber in the phantom.  Two buffers with the
+ * same hash are the same, whatever phantom the scatterers come from.
+ */
+uint64_t fieldBuffer::configurationHash(double freq) {
+    setFrequency(freq);
+
+    // bump when the way the buffer is calculated changes
+    const int version = 3;
+    uint64_t h = hashInt(version, hashSeed);
+
+    h = hashDouble(freq, h);
+    h = hashDouble(K.real(), h);
+    h = hashDouble(K.imag(), h);
+    h = hashDouble(target->soundSpeed(), h);
+
+    h = hashDouble(transFocus, h);
+    // single focus buffers keep the hashes they had before there were zones
+    if (!transZoneFoci.empty()) {
+        h = hashInt(transZoneFoci.size(), h);
+        for (size_t i = 0; i < transZoneFoci.size(); i++)
+            h = hashDouble(transZoneFoci[i], h);
+    }
+    h = hashDouble(assumedSoundSpeed, h);
+    h = hashDouble(size.x, h);
+    h = hashDouble(size.y, h);
+    h = hashDouble(size.z, h);
+    h = hashDouble(step.x, h);
+    h = hashDouble(step.y, h);
+    h = hashDouble(step.z, h);
+    h = hashDouble(center.z, h);
+    h = hashInt(xLen, h);
+    h = hashInt(xLenExtra, h);
+    h = hashInt(yLen, h);
+    h = hashInt(zLen, h);
+    h = hashInt(denseFactor, h);
+
+    h = hashDouble(transducer->geom.width, h);
+    h = hashDouble(transducer->geom.length, h);
+    h = hashDouble(transducer->spacing, h);
+    h = hashInt(transducer->eleCnt, h);
+    h = hashDouble(transducer->trnsFnum, h);
+    h = hashDouble(transducer->recvFnum, h);
+    h = hashDouble(transducer->assumedSoundSpeed, h);
+
+    // rectangular apodization keeps the hashes from before there was a choice
+    if (transducer->trnsWindow != rectWindow || transducer->recvWindow != rectWindow) {
+        h = hashInt(transducer->trnsWindow, h);
+        h = hashInt(transducer->recvWindow, h);
+        h = hashDouble(transducer->tukeyTaper, h);
+    }
+
+    // as do buffers of the Fresnel engine
+    if (engine != fresnelEngine)
+        h = hashInt(engine, h);
+
+    // double buffers keep the hashes they had before there was a choice
+    if (precision == singlePrecision)
+        h = hashInt(precision, h);
+
+    return h;
+}
+
+/*!Work out the focusing delays and apodization weights of the transmit focus, or of each
+ * transmit zone, and of the dynamic receive focus at every depth of the buffer.
+ */
+void fieldBuffer::setupDelays() {
+    std::vector<double> transFoci = transZoneFoci;
+    if (transFoci.empty()) transFoci.push_back(transFocus);
 
-    // setup single lateral transmit/receive focus
-    transducer->setTransFocus(transFocus, transducer->trsFnum(), freq);
+    std::vector<double> recFoci(zLen);
+    for (int zIndex=-(zLen-1)/2; zIndex <=(zLen-1)/2; zIndex++) {
+        double z = zIndex*step.z + center.z;
+        recFoci[zIndex + (zLen-1)/2] = z*assumedSoundSpeed/target->soundSpeed();
+    }
+
+    delete transDelays;
+    delete recDelays;
+    transDelays = new delayTable(transducer->eleCnt, transducer->spacing,
+                                 transducer->assumedSoundSpeed);
+    transDelays->setAperture(transducer->trnsFnum, transducer->trnsWindow,
+                             transducer->tukeyTaper);
+    transDelays->setFoci(transFoci);
+    recDelays = new delayTable(transducer->eleCnt, transducer->spacing,
+                               transducer->assumedSoundSpeed);
+    recDelays->setAperture(transducer->recvFnum, transducer->recvWindow,
+                           transducer->tukeyTaper);
+    recDelays->setFoci(recFoci);
+}
+
+/*!Calculate the field seen by the transducer at each location.
+ * This field is the product of incident and reflected sound at each location
+ */
+void fieldBuffer::calculateBufferField(double freq) {
+    // setup frequency
+    setFrequency(freq);
+
+    // The transmit phases change only between zones, the receive focus is
+    // dynamic and changes with depth
+    if (!transDelays) setupDelays();
+    int zone = -1;
+
+    if (engine == angularSpectrumEngine) {
+        if (!spectrum) {
+            spectrum = new angularSpectrum(transducer->eleCnt, transducer->spacing,
+                                           transducer->geom.width, transducer->geom.length,
+                                           step.x, xLen, step.y, (yLen+1)/2, step.z);
+            planeTransField = new cplx[xLen*(yLen+1)/2];
+            planeRecField = new cplx[xLen*(yLen+1)/2];
+        }
+        spectrum->setWavenumber(K);
+    }
 
     // loop through the depth
     for (int zIndex=-(zLen-1)/2; zIndex <=(zLen-1)/2; zIndex++) {
         // get the z coordinate, set dynamic receive focus
-        loc.z = zIndex*step.z + center.z;
-        transducer->setRecFocus(loc.z*assumedSoundSpeed/target->soundSpeed(),
-                                transducer->recFnum(),
-                                freq);
-
-        // loop through y direction
-        for (int yIndex=-(yLen-1)/2; yIndex <=0; yIndex++) {
-            // get z cord
-            loc.y = yIndex*step.y;
-
-            // loop through half of the x direction
-            for (int xIndex=-(xLenExtra-1)/2; xIndex <=0; xIndex++) {
-                // get x cord
-                loc.x = xIndex*(step.x);
-
-                cplx tSum = cplxZero;
-                cplx rSum = cplxZero;
-
-                tSum += getSingleElementField(loc, perfectTrans, K);
-                rSum += getSingleElementField(loc, perfectRec, K);
-
-                // get the field by single element
-                singleRowTransField[xIndex+(xLenExtra-1)/2] = tSum;
-                singleRowRecField[xIndex+(xLenExtra-1)/2] = rSum;
-            }
+        double z = zIndex*step.z + center.z;
+        int depthZone = transZoneFoci.empty() ? 0 : transmitZone(z);
+        if (depthZone != zone) {
+            zone = depthZone;
+            transDelays->phases(zone, freq, transducer->transPhase);
+            superposition->setTransmitWeights(transducer->transPhase);
+        }
+        recDelays->phases(zIndex + (zLen-1)/2, freq, transducer->recPhase);
+        superposition->setReceiveWeights(transducer->recPhase);
 
+        if (engine == angularSpectrumEngine)
+            spectrumPlane(zIndex, z);
+        else
+            fresnelPlane(zIndex, z);
+    }
+}
 
-            // get another half of x by symmetry
-            for (int xIndex=(xLenExtra+1)/2; xIndex < xLenExtra; xIndex++) {
-                singleRowTransField[xIndex] =
-                                    singleRowTransField[xLenExtra-1-xIndex];
+/*!The buffer at one depth from the single element fields along each lateral row, added up
+ * over the elements.  The transmit and receive fields are symmetric laterally, so half of
+ * each row is calculated.
+ */
+void fieldBuffer::fresnelPlane(int zIndex, double z) {
+    singleGeom perfectTrans, perfectRec;
+    perfectRec = transducer->geom;
+    perfectTrans = transducer->geom;
+    bool sameGeometry = perfectTrans.width == perfectRec.width &&
+                        perfectTrans.length == perfectRec.length;
+
+    // loop through y direction
+    for (int yIndex=-(yLen-1)/2; yIndex <=0; yIndex++) {
+        // get z cord
+        double y = yIndex*step.y;
+
+        // half of the x direction, the transmit and receive elements are
+        // the same unless their geometries differ
+        int halfRow = (xLenExtra+1)/2;
+        rowKernel->evaluate(singleRowX, halfRow, y, z,
+                            perfectTrans.width, perfectTrans.length, K, *fres,
+                            singleRowTransField);
+        if (!sameGeometry) {
+            rowKernel->evaluate(singleRowX, halfRow, y, z,
+                                perfectRec.width, perfectRec.length, K, *fres,
+                                singleRowRecField);
+        }
 
+        // get another half of x by symmetry
+        for (int xIndex=(xLenExtra+1)/2; xIndex < xLenExtra; xIndex++) {
+            singleRowTransField[xIndex] =
+                                singleRowTransField[xLenExtra-1-xIndex];
+            if (!sameGeometry)
                 singleRowRecField[xIndex] =
-                                      singleRowRecField[xLenExtra-1-xIndex];
-            }
-
+                                  singleRowRecField[xLenExtra-1-xIndex];
+        }
 
-            int tempXIndex1, tempXIndex2, index1, index2;
-            // get array field by superpose all the elements
-            for (int i=0; i < (xLen+1)/2; i++) {
-                cplx a0Transmit = cplxZero;
-                cplx a0Receive = cplxZero;
+        // get array field by superpose all the elements
+        superposition->sum(singleRowTransField,
+                           sameGeometry ? singleRowTransField : singleRowRecField,
+                           rowTransSum, rowRecSum);
 
-                // sum over all the elements
-                for (int j=0; j < transducer->eleCnt; j++) {
-                    a0Transmit += singleRowTransField[i+j*denseFactor] *
-                                                     transducer->transPhase[j];
-                    a0Receive += singleRowRecField[i+j*denseFactor] *
-                                                     transducer->recPhase[j];
-                }
+        int tempXIndex1, tempXIndex2, index1, index2;
+        for (int i=0; i < (xLen+1)/2; i++) {
+            // save the result to the buffer
+            tempXIndex1 = (xLen-1)/2-i;
+            index1 = (tempXIndex1 + (xLen-1)/2)*arrayPlaneSize
+            + (yIndex + (yLen-1)/2)*zLen
+            + (zIndex + (zLen-1)/2);
+            cplx value = rowTransSum[i]*rowRecSum[i];
+            if (arrayField) arrayField[index1] = value;
+            if (arrayFieldFloat) arrayFieldFloat[index1] = cplxFloat(value);
 
-                // save the result to the buffer
-                tempXIndex1 = (xLen-1)/2-i;
-                index1 = (tempXIndex1 + (xLen-1)/2)*arrayPlaneSize
-                + (yIndex + (yLen-1)/2)*zLen
-                + (zIndex + (zLen-1)/2);
-                arrayField[index1] = a0Transmit*a0Receive;
+            tempXIndex2 = i-(xLen-1)/2;
+            index2 = (tempXIndex2 + (xLen-1)/2)*arrayPlaneSize
+            + (yIndex + (yLen-1)/2)*zLen
+            + (zIndex + (zLen-1)/2);
+            if (arrayField) arrayField[index2] = value;
+            if (arrayFieldFloat) arrayFieldFloat[index2] = cplxFloat(value);
+        }
+    }
+}
 
-                tempXIndex2 = i-(xLen-1)/2;
-                index2 = (tempXIndex2 + (xLen-1)/2)*arrayPlaneSize
-                + (yIndex + (yLen-1)/2)*zLen
-                + (zIndex + (zLen-1)/2);
-                arrayField[index2] = arrayField[index1];
-            }
+/*!The buffer at one depth from the transmit and receive fields of the whole plane, by
+ * angular spectrum propagation.
+ */
+void fieldBuffer::spectrumPlane(int zIndex, double z) {
+    spectrum->setDepth(z);
+    spectrum->planeField(transducer->transPhase, planeTransField);
+    spectrum->planeField(transducer->recPhase, planeRecField);
+
+    for (int yIndex=-(yLen-1)/2; yIndex <=0; yIndex++) {
+        int row = (yIndex + (yLen-1)/2)*xLen;
+        for (int xIndex=0; xIndex < xLen; xIndex++) {
+            int index = xIndex*arrayPlaneSize
+                        + (yIndex + (yLen-1)/2)*zLen
+                        + (zIndex + (zLen-1)/2);
+            cplx value = planeTransField[row + xIndex]*planeRecField[row + xIndex];
+            if (arrayField) arrayField[index] = value;
+            if (arrayFieldFloat) arrayFieldFloat[index] = cplxFloat(value);
         }
     }
 }
@@ -364,28 +674,388 @@ void fieldBuffer::calculateBufferField(double freq) {
  * phase term.
  */
 cplx fieldBuffer::bufferField(const vector& loc) {
-    int xIndex = static_cast<int>(floor(loc.x/step.x + .5));
-    int yIndex = static_cast<int>(floor(loc.y/step.y + .5));
+    cellFraction fraction;
+    fieldSample sample = bufferIndex(loc, &fraction);
+    if (interpolation == nearestPoint)
+        return bufferField(sample);
+    return directInterpolatedField(sample, fraction);
+}
 
-    // zIndex will run from roughly -zLen/2 to zLen/2
-    int zIndex = static_cast<int>(floor((loc.z-center.z)/step.z + .5));
+/*!The sum of bufferField over count samples, such as the scatterers of a beamline, for a
+ * single precision buffer.  It is worked out a block of lanes at a time, each lane with its
+ * own compensated (Kahan) sum so the rounding error does not grow with the number of
+ * samples, and with the float sinCos and expNoBranch of fastMath.h for the axial phase.
+ * Every lane does the same branch free arithmetic, so the compiler can vectorize the block.
+ */
+cplx fieldBuffer::bufferSumFloat(const fieldSample* samples, size_t count) {
+    const int lanes = 8;
+    const float phasePerDz = 2*KFloat.real(), decayPerDz = -2*KFloat.imag();
+    float sumReal[lanes] = {}, sumImag[lanes] = {};
+    float carryReal[lanes] = {}, carryImag[lanes] = {};
+
+    for (size_t first = 0; first < count; first += lanes) {
+        // the lanes past the last sample repeat it and add nothing
+        float valueReal[lanes], valueImag[lanes], dz[lanes], live[lanes];
+        for (int l = 0; l < lanes; l++) {
+            size_t j = std::min(first + l, count - 1);
+            cplxFloat value = arrayFieldFloat[samples[j].index];
+            valueReal[l] = value.real();
+            valueImag[l] = value.imag();
+            dz[l] = static_cast<float>(samples[j].dz);
+            live[l] = first + l < count ? 1.0f : 0.0f;
+        }
 
-    if (yIndex > 0) yIndex = -yIndex;
+        float termReal[lanes], termImag[lanes];
+        for (int l = 0; l < lanes; l++) {
+            float sn, cs;
+            sinCos(phasePerDz*dz[l], &sn, &cs);
+            float magnitude = live[l]*expNoBranch(decayPerDz*dz[l]);
+            termReal[l] = magnitude*(valueReal[l]*cs - valueImag[l]*sn);
+            termImag[l] = magnitude*(valueReal[l]*sn + valueImag[l]*cs);
+        }
+        for (int l = 0; l < lanes; l++) {
+            float term = termReal[l] - carryReal[l];
+            float next = sumReal[l] + term;
+            carryReal[l] = (next - sumReal[l]) - term;
+            sumReal[l] = next;
+
+            term = termImag[l] - carryImag[l];
+            next = sumImag[l] + term;
+            carryImag[l] = (next - sumImag[l]) - term;
+            sumImag[l] = next;
+        }
+    }
+
+    cplx sum = cplxZero;
+    for (int l = 0; l < lanes; l++)
+        sum += cplx(sumReal[l] - carryReal[l], sumImag[l] - carryImag[l]);
+    return sum;
+}
 
-    double zc = center.z + zIndex*step.z;
+namespace {
 
-    cplx temp;
-    int index = (xIndex + (xLen-1)/2)*arrayPlaneSize
+/*!  The lower corner along one axis of the grid cell holding t, in grid steps, kept inside
+ * lowest to highest so that both corners are in the buffer.  The position of t within the
+ * cell goes to fraction.
+ */
+int lowerCorner(double t, int lowest, int highest, float* fraction) {
+    int corner = static_cast<int>(floor(t));
+    if (highest - 1 < lowest) {
+        *fraction = 0;
+        return lowest;
+    }
+    corner = std::max(lowest, std::min(highest - 1, corner));
+    *fraction = static_cast<float>(std::max(0., std::min(1., t - corner)));
+    return corner;
+}
+
+}  // namespace
+
+/*!Find where location loc falls in the grid, see fieldSample, and in the interpolating modes
+ * its position in the cell.  Together with the buffer of the current frequency this gives the
+ * field at loc, see bufferField and interpolatedField.
+ */
+fieldSample fieldBuffer::bufferIndex(const vector& loc, cellFraction* fraction) {
+    fieldSample sample;
+    fraction->fx = fraction->fy = fraction->fz = 0;
+
+    if (interpolation == nearestPoint) {
+        int xIndex = static_cast<int>(floor(loc.x/step.x + .5));
+        int yIndex = static_cast<int>(floor(loc.y/step.y + .5));
+
+        // zIndex will run from roughly -zLen/2 to zLen/2
+        int zIndex = static_cast<int>(floor((loc.z-center.z)/step.z + .5));
+
+        if (yIndex > 0) yIndex = -yIndex;
+
+        double zc = center.z + zIndex*step.z;
+
+        sample.index = (xIndex + (xLen-1)/2)*arrayPlaneSize
+                + (yIndex + (yLen-1)/2)*zLen
+                + (zIndex + (zLen-1)/2);
+
+
+        // the phase term should be the difference in r rather
+        // than z if the beam have angle
+        sample.dz = loc.z-zc;
+        return sample;
+    }
+
+    // the buffer holds y <= 0 only, the field is symmetric in y
+    double y = -fabs(loc.y);
+    int xIndex = lowerCorner(loc.x/step.x, -(xLen-1)/2, (xLen-1)/2, &fraction->fx);
+    int yIndex = lowerCorner(y/step.y, -(yLen-1)/2, 0, &fraction->fy);
+    int zIndex = lowerCorner((loc.z-center.z)/step.z, -(zLen-1)/2, (zLen-1)/2,
+                             &fraction->fz);
+
+    sample.index = (xIndex + (xLen-1)/2)*arrayPlaneSize
             + (yIndex + (yLen-1)/2)*zLen
             + (zIndex + (zLen-1)/2);
+    sample.dz = loc.z - (center.z + zIndex*step.z);
+    return sample;
+}
 
+/*!Work out what interpolatedField needs of the buffer of the current frequency, once for
+ * every point rather than once for every scatterer at every point around it:
+ * trilinearMagPhase takes the magnitude and phase of each point, phaseCorrected the phase
+ * advances of each cell and their unit phasors.  Call it once the buffer is filled, before
+ * interpolatedField.  Nearest point interpolation needs nothing.
+ */
+void fieldBuffer::prepareInterpolation() {
+    size_t count = bufferSize();
+    if (interpolation == trilinearMagPhase) {
+        pointPolars.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            cplx value = fieldAt(i);
+            pointPolars[i].magnitude = static_cast<float>(std::abs(value));
+            pointPolars[i].phase = static_cast<float>(std::arg(value));
+        }
+        return;
+    }
+    if (interpolation != phaseCorrected) return;
+
+    // the lower corners of the cells bufferIndex can give, as in interpolatedField
+    const int xStride = xLen > 1 ? arrayPlaneSize : 0;
+    const int yStride = yLen > 1 ? zLen : 0;
+    const int zStride = zLen > 1 ? 1 : 0;
+    const int xCells = std::max(xLen - 1, 1);
+    const int yCells = std::max((yLen - 1)/2, 1);
+    const int zCells = std::max(zLen - 1, 1);
+
+    cellAdvances.resize(count);
+    for (int xIndex = 0; xIndex < xCells; xIndex++) {
+        for (int yIndex = 0; yIndex < yCells; yIndex++) {
+            for (int zIndex = 0; zIndex < zCells; zIndex++) {
+                int index = xIndex*arrayPlaneSize + yIndex*zLen + zIndex;
+                cplx value[8];
+                for (int c = 0; c < 8; c++) {
+                    value[c] = fieldAt(index + (c >> 2)*xStride + ((c >> 1) & 1)*yStride
+                                       + (c & 1)*zStride);
+                    if (c & 1) value[c] *= zStepPhase;
+                }
 
-    // the phase term should be the difference in r rather
-    // than z if the beam have angle
-    return arrayField[index]*exp(2.*(loc.z-zc)*imUnit*K);
+                // mean phase advance along each axis, summed over the four cell edges
+                cplx advance[3] = {cplxZero, cplxZero, cplxZero};
+                for (int c = 0; c < 8; c++) {
+                    if (!(c & 4)) advance[0] += value[c | 4]*conj(value[c]);
+                    if (!(c & 2)) advance[1] += value[c | 2]*conj(value[c]);
+                    if (!(c & 1)) advance[2] += value[c | 1]*conj(value[c]);
+                }
+                cellAdvance& cell = cellAdvances[index];
+                for (int a = 0; a < 3; a++) {
+                    double angle = abs(advance[a]) > 0 ? arg(advance[a]) : 0;
+                    cell.angle[a] = static_cast<float>(angle);
+                    cell.unit[a] = cplxFloat(std::polar(1., -angle));
+                }
+            }
+        }
+    }
+}
+
+namespace {
+
+// a complex product without the checks for infinite and NaN parts that operator* makes,
+// which call out of the gather loops below
+inline cplx times(const cplx& a, const cplx& b) {
+    return cplx(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+}  // namespace
+
+/*!The field at a location found by bufferIndex in one of the interpolating modes.  The
+ * round trip phase 2Kd over the axial distance d from each corner to the location is put back
+ * first, leaving corner values that vary slowly.
+ *
+ * trilinearMagPhase then interpolates magnitude and phase separately, each corner's phase
+ * unwrapped against the first corner's.  phaseCorrected finds the mean phase advance of the
+ * cell along each axis from its edges, removes it from the corners, interpolates the complex
+ * values and puts the phase back at the location.  Unlike magnitude and phase it stays well
+ * behaved near nulls of the field, where the phase of a corner means little.
+ */
+cplx fieldBuffer::interpolatedField(const fieldSample& sample, const cellFraction& fraction) {
+    return interpolatedSum(&sample, &fraction, 1);
+}
+
+/*!The sum of interpolatedField over count samples, such as the scatterers of a beamline.
+ * The magnitudes, phases and phase advances come from the tables of prepareInterpolation,
+ * so a sample costs one branch free sin, cos and exp (fastMath.h) for the phase put back at
+ * the location, and otherwise only arithmetic.  directInterpolatedField is the same from the
+ * buffer values alone.
+ */
+cplx fieldBuffer::interpolatedSum(const fieldSample* samples, const cellFraction* fractions,
+                                  size_t count) {
+    if (interpolation == trilinearMagPhase)
+        return trilinearSum(samples, fractions, count);
+    if (precision == singlePrecision)
+        return phaseCorrectedSum(arrayFieldFloat, samples, fractions, count);
+    return phaseCorrectedSum(arrayField, samples, fractions, count);
 }
 
+cplx fieldBuffer::trilinearSum(const fieldSample* samples, const cellFraction* fractions,
+                               size_t count) {
+    // corner c is at (c>>2, (c>>1)&1, c&1) in (x, y, z) from the lower corner, none along
+    // an axis of one grid point
+    int offset[8];
+    for (int c = 0; c < 8; c++)
+        offset[c] = (c >> 2)*(xLen > 1 ? arrayPlaneSize : 0) +
+                    ((c >> 1) & 1)*(yLen > 1 ? zLen : 0) + (c & 1)*(zLen > 1 ? 1 : 0);
+
+    // zStepPhase as a magnitude and an angle
+    const double stepAngle = -2*step.z*K.real();
+    const double stepMagnitude = std::abs(zStepPhase);
+    const double phasePerDz = 2*K.real(), decayPerDz = -2*K.imag();
+
+    double sumReal = 0, sumImag = 0;
+    for (size_t j = 0; j < count; j++) {
+        const fieldSample& s = samples[j];
+        const double fx = fractions[j].fx, fy = fractions[j].fy, fz = fractions[j].fz;
+        const pointPolar* lower = &pointPolars[s.index];
+        const double reference = lower->phase;
+
+        double magnitude = 0, advance = 0;
+        for (int c = 0; c < 8; c++) {
+            double weight = (c & 4 ? fx : 1 - fx)*(c & 2 ? fy : 1 - fy)*(c & 1 ? fz : 1 - fz);
+            double cornerMagnitude = lower[offset[c]].magnitude;
+            double difference = lower[offset[c]].phase - reference;
+            if (c & 1) {
+                cornerMagnitude *= stepMagnitude;
+                difference += stepAngle;
+            }
+            difference -= 2*M_PI*roundToInteger(difference*(0.5*M_1_PI));
+            magnitude += weight*cornerMagnitude;
+            advance += weight*difference;
+        }
+
+        double sn, cs;
+        sinCos(phasePerDz*s.dz + reference + advance, &sn, &cs);
+        magnitude *= expNoBranch(decayPerDz*s.dz);
+        sumReal += magnitude*cs;
+        sumImag += magnitude*sn;
+    }
+    return cplx(sumReal, sumImag);
+}
 
+template <typename T>
+cplx fieldBuffer::phaseCorrectedSum(const T* buffer, const fieldSample* samples,
+                                    const cellFraction* fractions, size_t count) {
+    const int xStride = xLen > 1 ? arrayPlaneSize : 0;
+    const int yStride = yLen > 1 ? zLen : 0;
+    const int zStride = zLen > 1 ? 1 : 0;
+    const double phasePerDz = 2*K.real(), decayPerDz = -2*K.imag();
+
+    cplx sum = cplxZero;
+    for (size_t j = 0; j < count; j++) {
+        const fieldSample& s = samples[j];
+        const double fx = fractions[j].fx, fy = fractions[j].fy, fz = fractions[j].fz;
+        const cellAdvance& cell = cellAdvances[s.index];
+        const cplx xUnit(cell.unit[0]), yUnit(cell.unit[1]);
+        const cplx zUnit = times(zStepPhase, cplx(cell.unit[2]));
+
+        // along z within each of the four lateral and elevational edges, then across them
+        cplx edge[4];
+        for (int e = 0; e < 4; e++) {
+            const T* lower = buffer + s.index + (e >> 1)*xStride + (e & 1)*yStride;
+            edge[e] = (1 - fz)*cplx(lower[0]) + fz*times(cplx(lower[zStride]), zUnit);
+        }
+        cplx field = (1 - fx)*((1 - fy)*edge[0] + fy*times(edge[1], yUnit)) +
+                     fx*times((1 - fy)*edge[2] + fy*times(edge[3], yUnit), xUnit);
+
+        double sn, cs;
+        sinCos(phasePerDz*s.dz + cell.angle[0]*fx + cell.angle[1]*fy + cell.angle[2]*fz,
+               &sn, &cs);
+        double magnitude = expNoBranch(decayPerDz*s.dz);
+        sum += times(field, cplx(magnitude*cs, magnitude*sn));
+    }
+    return sum;
+}
+
+/*!interpolatedField worked out from the buffer values alone, for the double precision
+ * check and for bufferField at a location.
+ */
+cplx fieldBuffer::directInterpolatedField(const fieldSample& s, const cellFraction& f) {
+    // neighbouring corners along each axis, none along an axis of one grid point
+    const int xStride = xLen > 1 ? arrayPlaneSize : 0;
+    const int yStride = yLen > 1 ? zLen : 0;
+    const int zStride = zLen > 1 ? 1 : 0;
+    const double fx = f.fx, fy = f.fy, fz = f.fz;
+
+    // corner c is at (c>>2, (c>>1)&1, c&1) in (x, y, z) from the lower corner
+    cplx value[8];
+    for (int c = 0; c < 8; c++) {
+        value[c] = fieldAt(s.index + (c >> 2)*xStride + ((c >> 1) & 1)*yStride
+                           + (c & 1)*zStride);
+        if (c & 1) value[c] *= zStepPhase;
+    }
+    cplx axialPhase = exp(2.*s.dz*imUnit*K);
+
+    if (interpolation == trilinearMagPhase) {
+        double magnitude = 0, phase = 0;
+        double reference = arg(value[0]);
+        for (int c = 0; c < 8; c++) {
+            double weight = (c & 4 ? fx : 1 - fx)*(c & 2 ? fy : 1 - fy)*(c & 1 ? fz : 1 - fz);
+            magnitude += weight*abs(value[c]);
+            phase += weight*remainder(arg(value[c]) - reference, 2*M_PI);
+        }
+        return axialPhase*std::polar(magnitude, reference + phase);
+    }
+
+    // mean phase advance along each axis, summed over the four cell edges along it
+    cplx advance[3] = {cplxZero, cplxZero, cplxZero};
+    for (int c = 0; c < 8; c++) {
+        if (!(c & 4)) advance[0] += value[c | 4]*conj(value[c]);
+        if (!(c & 2)) advance[1] += value[c | 2]*conj(value[c]);
+        if (!(c & 1)) advance[2] += value[c | 1]*conj(value[c]);
+    }
+    double angle[3];
+    cplx unit[3];
+    for (int a = 0; a < 3; a++) {
+        angle[a] = abs(advance[a]) > 0 ? arg(advance[a]) : 0;
+        unit[a] = std::polar(1., -angle[a]);
+    }
+
+    cplx field = cplxZero;
+    for (int c = 0; c < 8; c++) {
+        double weight = (c & 4 ? fx : 1 - fx)*(c & 2 ? fy : 1 - fy)*(c & 1 ? fz : 1 - fz);
+        cplx v = value[c];
+        if (c & 4) v *= unit[0];
+        if (c & 2) v *= unit[1];
+        if (c & 1) v *= unit[2];
+        field += weight*v;
+    }
+    return axialPhase*field*std::polar(1., angle[0]*fx + angle[1]*fy + angle[2]*fz);
+}
+
+/*!Whether bufferIndex(loc) lies inside the buffer.  Locations outside it, such as scatterers
+ * beyond the elevational extent of the transducer, have no field and would index past the
+ * buffer.  Elevationally the buffer only holds y <= 0, the other half being its mirror image.
+ */
+bool fieldBuffer::inBuffer(const vector& loc) {
+    int xIndex = static_cast<int>(floor(loc.x/step.x + .5));
+    int yIndex = static_cast<int>(floor(loc.y/step.y + .5));
+    int zIndex = static_cast<int>(floor((loc.z-center.z)/step.z + .5));
+
+    if (yIndex > 0) yIndex = -yIndex;
+
+    return abs(xIndex) <= (xLen-1)/2 &&
+           yIndex >= -(yLen-1)/2 &&
+           abs(zIndex) <= (zLen-1)/2;
+}
+
+/*!The box, in phantom coordinates, outside which no location is inBuffer, widened by a grid
+ * step so that rounding cannot drop a scatterer on its edge.  Scatterers inside the box still
+ * have to be checked with inBuffer.
+ */
+void fieldBuffer::phantomExtent(myVector* lower, myVector* upper) {
+    double halfY = (yLen/2. + 1)*step.y;
+    double halfZ = (zLen/2. + 1)*step.z;
+
+    lower->x = -HUGE_VAL;
+    upper->x = HUGE_VAL;
+    lower->y = center.y - halfY;
+    upper->y = center.y + halfY;
+    lower->z = center.z - halfZ - phantomGap;
+    upper->z = center.z + halfZ - phantomGap;
+}
 
 
 /*! Given a position on the phantom. 0<x<phantom size
@@ -4,13 +4,100 @@
 #define FULL_APERTURE -1
 #include <stdio.h>
 #include <assert.h>
+
+#include <vector>
+
+#include "./angularSpectrum.h"
+#include "./delayTable.h"
+#include "./elementKernel.h"
 #include "./phantom.h"
+#include "./superposition.h"
 #include "./util.h"
 
 class array;
 class fieldBuffer;
 class phantom;
 
+/*! \brief Where a location falls in the field buffer.  This does not depend on frequency,
+ * so it can be worked out once for each scatterer and reused at every frequency.
+ *
+ * With nearest point interpolation index is the grid point nearest to the location.  The
+ * interpolating modes use the grid cell around the location instead: index is its lower
+ * corner, and the position of the location within the cell is a cellFraction kept apart,
+ * so the nearest point mode does not carry it.
+ */
+struct fieldSample {
+    int index;       // index into the buffer of the nearest grid point or lower cell corner
+    double dz;       // axial distance from that grid point to the location
+};
+
+/*! \brief The position of a location within its grid cell, 0 to 1 along each axis, for the
+ * interpolating modes.
+ */
+struct cellFraction {
+    float fx, fy, fz;
+};
+
+/*! \brief Magnitude and phase of a buffer point, for trilinearMagPhase.  See
+ * fieldBuffer::prepareInterpolation.
+ */
+struct pointPolar {
+    float magnitude, phase;
+};
+
+/*! \brief The mean phase advance along each axis of a grid cell, and the unit phasors that
+ * take it out, for phaseCorrected.  See fieldBuffer::prepareInterpolation.
+ */
+struct cellAdvance {
+    float angle[3];
+    cplxFloat unit[3];
+};
+
+/*! \brief How the field between grid points is found.
+ *
+ * nearestPoint uses the nearest grid point with an axial phase correction, which needs a
+ * fine grid.  trilinearMagPhase interpolates the magnitude and the unwrapped phase over the
+ * eight corners of the cell, after removing the axial phase.  phaseCorrected interpolates
+ * the complex field after also removing the mean lateral, elevational and axial phase
+ * advance across the cell.  See fieldBuffer::interpolatedField.
+ */
+enum interpolationMode {
+    nearestPoint,
+    trilinearMagPhase,
+    phaseCorrected
+};
+
+/*! \brief How the field buffer is stored.  singlePrecision halves the memory of the buffer
+ * and the memory traffic of gathering from it.  The buffer is still calculated in double.
+ */
+enum fieldPrecision {
+    doublePrecision,
+    singlePrecision
+};
+
+/*! \brief How calculateBufferField works out the field.
+ *
+ * fresnelEngine adds up the Fresnel approximation of the field of each element, row by row.
+ * angularSpectrumEngine propagates the spectrum of the whole aperture to each depth with
+ * FFTs, which is exact for the baffled elements but for the grid, so it stays accurate
+ * close to the array where the Fresnel approximation does not.  It costs O(n log n) in the
+ * points of a padded plane whatever the number of elements, more than the Fresnel engine
+ * on the usual grids.  See angularSpectrum.
+ */
+enum fieldEngine {
+    fresnelEngine,
+    angularSpectrumEngine
+};
+
+/*! \brief A grid of the field buffer, its steps whole multiples of the finest steps, those
+ * given to the fieldBuffer constructor, laterally (x), elevationally (y) and axially (z).
+ * The grid points are a subset of the finest ones.  See fieldBuffer::setPointsPerWavelength.
+ */
+struct gridFactors {
+    int x, y, z;
+
+    bool operator==(const gridFactors& g) const { return x == g.x && y == g.y && z == g.z; }
+};
 
 // structure used to describe a single rectangular element
 struct singleGeom {
@@ -46,15 +133,23 @@ class array {
   void setTrsFnum(double Fnum);
   void setRecFnum(double Fnum);
 
+  void setTrsApodization(apodizationWindow w) { trnsWindow = w; }
+  void setRecApodization(apodizationWindow w) { recvWindow = w; }
+  void setTaper(double t) { tukeyTaper = t; }
+  // apodization across the active aperture, and the taper fraction of the
+  // Tukey window.  Set these and the F numbers before any field is calculated.
+
  private:
-  void setFocus(cplx*, double, double, double);
+  void setFocus(cplx*, double, double, apodizationWindow, double);
   // common routine to set lateral focus
-  // (phase factor[], focal distance, F number, frequency);
+  // (phase factor[], focal distance, F number, window, frequency);
 
   singleGeom geom;  // hold the elevational geometry info
   double spacing;   // spacing between elements
   int eleCnt;       // number of elements
   double trnsFnum, recvFnum;
+  apodizationWindow trnsWindow, recvWindow;
+  double tukeyTaper;
   cplx *transPhase;  // transmit lateral phase factors
   cplx *recPhase;    // receive lateral phase factors
   double assumedSoundSpeed;
@@ -77,10 +172,113 @@ class fieldBuffer {  // incident pressure field associated with a phantom
   void calculateBufferField(double freq);
   // calculate the buffer at frequency (freq)
 
+  void setTransmitZones(const std::vector<double>& foci);
+  const std::vector<double>& giveTransmitZones() { return transZoneFoci; }
+  // several transmit foci, each used for the depths nearest to it.  The
+  // buffer is still calculated in one pass.
+
+  void setFrequency(double freq);
+  // set the wavenumber without calculating the buffer, for a buffer
+  // that is filled in some other way.  The buffer is allocated for the
+  // grid of freq.
+
+  void axialPhases(std::vector<cplx>* phase);
+  int giveDepthPoints() { return zLen; }
+  // the round trip propagation exp(2iKz) to each depth of the buffer, the
+  // part of the field that changes fastest with frequency.  The buffer index
+  // of depth i is i plus a multiple of giveDepthPoints().
+
+  void phantomDepths(int* first, int* last);
+  // the first and last depth of the buffer inside the phantom, between the gaps
+
+  cplx bufferValue(size_t index) { return fieldAt(index); }
+  void setBufferValue(size_t index, const cplx& value) {
+      if (arrayField) arrayField[index] = value;
+      if (arrayFieldFloat) arrayFieldFloat[index] = cplxFloat(value);
+  }
+  // a value of the buffer, in whichever precisions it is kept
+
+  uint64_t configurationHash(double freq);
+  // hash of everything the buffer at frequency (freq) depends on
+
+  void* buffer();
+  size_t bufferSize() {return static_cast<size_t>(xLen)*arrayPlaneSize;}
+  size_t bufferValueBytes();
+  // the buffer as stored in the current precision, and the size of a value
+
+  void setPrecision(fieldPrecision p, bool keepDouble);
+  fieldPrecision givePrecision() { return precision; }
+  // how the buffer is stored.  With keepDouble a single precision buffer
+  // also keeps the double values calculateBufferField rounded it from,
+  // for doubleField.
+
   cplx bufferField(const vector& loc);
   // get the pressure field at (location)
+
+  fieldSample bufferIndex(const vector& loc, cellFraction* fraction);
+  // get the frequency independent part of bufferField at (location), and
+  // in the interpolating modes its position in the cell
+
+  bool inBuffer(const vector& loc);
+  // whether the grid point nearest to (location) is part of the buffer
+
+  void phantomExtent(myVector* lower, myVector* upper);
+  // elevational and axial limits, in phantom coordinates, of the scatterers
+  // that can fall inside the buffer.  x is left to the caller.
+
+  cplx bufferField(const fieldSample& sample) {
+      return fieldAt(sample.index)*exp(2.*sample.dz*imUnit*K);
+  }
+  // get the pressure field at a location found by bufferIndex, nearest point
+
+  cplx bufferSumFloat(const fieldSample* samples, size_t count);
+  // its sum over count samples in single precision arithmetic, single
+  // precision buffers only
+
+
+  void prepareInterpolation();
+  cplx interpolatedField(const fieldSample& sample, const cellFraction& fraction);
+  cplx interpolatedSum(const fieldSample* samples, const cellFraction* fractions,
+                       size_t count);
+  // the same for the interpolating modes, once prepareInterpolation has
+  // worked out its tables from the buffer of the current frequency, and
+  // its sum over count samples
+
+  cplx doubleField(const fieldSample& sample, const cellFraction* fraction);
+  // the field in the current interpolation mode from the double values the
+  // buffer was rounded from, for single precision buffers with keepDouble.
+  // fraction is only used by the interpolating modes.
+
+  void setInterpolation(interpolationMode mode) { interpolation = mode; }
+  interpolationMode giveInterpolation() { return interpolation; }
+  // how bufferIndex and bufferField find the field between grid points.
+  // Set it before working out any fieldSample.
   void beamProfile();
 
+  void setPointsPerWavelength(double points) { pointsPerWavelength = points; }
+  double givePointsPerWavelength() { return pointsPerWavelength; }
+  // choose the grid of each frequency for at least this many points a
+  // wavelength along each axis, no finer than the steps given to the
+  // constructor.  0, the default, uses those steps at every frequency.
+
+  gridFactors gridFor(double freq);
+  void useGrid(const gridFactors& g);
+  vector giveStep() { return step; }
+  // the grid of the buffer at frequency (freq), making a grid the current
+  // one, and the steps of the current grid.  setFrequency and so
+  // calculateBufferField make the grid of their frequency current, and
+  // bufferIndex, inBuffer and phantomExtent work on the current grid.
+
+  void setEngine(fieldEngine e) { engine = e; }
+  fieldEngine giveEngine() { return engine; }
+  // how calculateBufferField works out the field, see fieldEngine
+
+  void setSuperposition(superpositionMode mode) { superposition->setMode(mode); }
+  // how calculateBufferField adds up the elements, see superpositionMode
+  long fftSuperposedRows() { return fftRowsBefore + superposition->fftRows(); }
+  long directSuperposedRows() { return directRowsBefore + superposition->directRows(); }
+  // the rows it has added up each way so far
+
   vector giveCenter() {return center; }
   double giveImageDepth() {return size.z;}
 
@@ -97,10 +295,23 @@ class fieldBuffer {  // incident pressure field associated with a phantom
 
  private:
   double transFocus;  // Transmit focus
+  std::vector<double> transZoneFoci;  // the foci of the transmit zones, if any
   vector size;       // the field size to be calculated
   vector step;       // the grid step
   vector center;     // center of the field
   cplx K;            // cplx wavenumber
+  cplx zStepPhase;   // round trip phase over one axial step, exp(-2iK step.z)
+  interpolationMode interpolation;
+  std::vector<pointPolar> pointPolars;    // of every buffer point, trilinearMagPhase
+  std::vector<cellAdvance> cellAdvances;  // of every cell by lower corner, phaseCorrected
+  cplx directInterpolatedField(const fieldSample& sample, const cellFraction& fraction);
+  // interpolatedField straight from the buffer values, without the tables
+  cplx trilinearSum(const fieldSample* samples, const cellFraction* fractions,
+                    size_t count);
+  template <typename T>
+  cplx phaseCorrectedSum(const T* buffer, const fieldSample* samples,
+                         const cellFraction* fractions, size_t count);
+  // interpolatedSum in each mode
   phantom* target;
   int xLen;  // x dimension
   int xLenExtra;  //
@@ -110,6 +321,17 @@ class fieldBuffer {  // incident pressure field associated with a phantom
   // densefactor is the number of calculated points along each element
   int denseFactor;
 
+  // The grid above is the current one, grid times the finest grid below.
+  // The buffer is allocated for the current grid by setFrequency.
+  double pointsPerWavelength;
+  gridFactors grid;
+  vector fineStep;
+  int fineXLen, fineYLen, fineZLen;
+  int fineDenseFactor;
+  size_t bufferAllocated;
+  void layoutGrid();
+  void allocateBuffer();
+
   int arrayLineSize;   // buffer line size
   int arrayPlaneSize;  // buffer plane size
 
@@ -117,8 +339,46 @@ class fieldBuffer {  // incident pressure field associated with a phantom
   cplx *singleRowTransField;
   // single row of the receive field, constant depth
   cplx *singleRowRecField;
+  // lateral position of each point of the first half of those rows
+  double *singleRowX;
+  elementRowKernel *rowKernel;
+  // focusing delays and apodization of each transmit zone and of each receive depth,
+  // worked out when the first buffer is calculated
+  delayTable *transDelays;
+  delayTable *recDelays;
+  void setupDelays();
+
+  // transmit and receive array fields of the half row of the buffer being calculated,
+  // and the rows added up by the superpositions of earlier grids
+  elementSuperposition *superposition;
+  long fftRowsBefore, directRowsBefore;
+  cplx *rowTransSum;
+  cplx *rowRecSum;
+
+  fieldEngine engine;
+  void fresnelPlane(int zIndex, double z);
+  void spectrumPlane(int zIndex, double z);
+  // the buffer at one depth, for each engine
+
+  // the angular spectrum engine and the transmit and receive fields of the
+  // half plane y <= 0 it makes, NULL until first used
+  angularSpectrum *spectrum;
+  cplx *planeTransField;
+  cplx *planeRecField;
+
+  cplx *arrayField;  // resulting buffer field, NULL if only single precision is kept
+  cplxFloat *arrayFieldFloat;  // the same in single precision, or NULL
+  fieldPrecision precision;
+  bool keepDouble;  // keep arrayField with a single precision buffer
+  cplxFloat KFloat;
+
+  int transmitZone(double depth);
+  // the zone of transZoneFoci that holds depth
+
+  cplx fieldAt(int index) {
+      return precision == singlePrecision ? cplx(arrayFieldFloat[index]) : arrayField[index];
+  }
 
-  cplx *arrayField;  // resulting buffer field */
   double assumedSoundSpeed;
   array* transducer;
   fresnelInt *fres;
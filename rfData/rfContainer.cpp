@@ -0,0 +1,148 @@
+#include "./rfContainer.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+namespace {
+
+const char rfMagic[8] = {'U', 'S', 'R', 'F', 'D', 'A', 'T', '\0'};
+const uint32_t rfVersion = 1;
+const uint32_t endianMark = 0x01020304;
+
+struct crcTable {
+    uint32_t entry[256];
+    crcTable() {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entry[n] = c;
+        }
+    }
+};
+
+}  // namespace
+
+static_assert(sizeof(rfFileHeader) == 64, "RF file header must be 64 bytes");
+static_assert(sizeof(rfChunkHeader) == 24, "RF chunk header must be 24 bytes");
+
+/*!  The reflected polynomial 0xEDB88320, the same as zlib, so files can be checked with
+ * any zlib binding.
+ */
+uint32_t crc32(const void* data, size_t size, uint32_t crc) {
+    static const crcTable table;
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table.entry[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+rfContainer::rfContainer(): type(rfDouble),
+                            freqPoints(0),
+                            beamlines(0),
+                            frames(0),
+                            failed(false)
+{}
+
+int rfContainer::create(const char* filename, rfSampleType sampleType,
+                        int points, int lines, int frameCount, double freqStep) {
+    type = sampleType;
+    freqPoints = points;
+    beamlines = lines;
+    frames = frameCount;
+    failed = false;
+
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        cout << "Failure to write RF data file named: " << filename << endl;
+        return 0;
+    }
+
+    rfFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, rfMagic, sizeof(rfMagic));
+    header.version = rfVersion;
+    header.endian = endianMark;
+    header.sampleType = type;
+    header.freqPoints = freqPoints;
+    header.beamlines = beamlines;
+    header.frames = frames;
+    header.freqStep = freqStep;
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.flush();
+    return file ? 1 : 0;
+}
+
+/*!  The samples are converted and checksummed before taking the lock, so only the write
+ * itself is serialized.
+ */
+int rfContainer::writeChunk(const cplx* fftCoef, int fIndex, int first, int count) {
+    size_t values = static_cast<size_t>(frames)*count;
+    size_t frameSize = static_cast<size_t>(freqPoints)*beamlines;
+
+    std::vector<cplx> row(values);
+    for (int f = 0; f < frames; f++) {
+        for (int l = 0; l < count; l++)
+            row[f*count + l] = fftCoef[f*frameSize
+                                      + static_cast<size_t>(first + l)*freqPoints + fIndex];
+    }
+
+    rfChunkHeader chunk;
+    memset(&chunk, 0, sizeof(chunk));
+    chunk.freqIndex = fIndex;
+    chunk.firstBeamline = first;
+    chunk.lineCount = count;
+    chunk.scale = 1;
+
+    std::vector<char> payload;
+    if (type == rfDouble) {
+        const char* begin = reinterpret_cast<const char*>(row.data());
+        payload.assign(begin, begin + values*sizeof(cplx));
+    } else if (type == rfFloat) {
+        std::vector<float> samples(2*values);
+        for (size_t i = 0; i < values; i++) {
+            samples[2*i] = static_cast<float>(row[i].real());
+            samples[2*i+1] = static_cast<float>(row[i].imag());
+        }
+        const char* begin = reinterpret_cast<const char*>(samples.data());
+        payload.assign(begin, begin + samples.size()*sizeof(float));
+    } else {
+        // the largest part of the chunk maps to the largest int16
+        double largest = 0;
+        for (size_t i = 0; i < values; i++)
+            largest = std::max(largest, std::max(fabs(row[i].real()), fabs(row[i].imag())));
+        if (largest > 0) chunk.scale = largest/32767;
+
+        std::vector<int16_t> samples(2*values);
+        for (size_t i = 0; i < values; i++) {
+            samples[2*i] = static_cast<int16_t>(floor(row[i].real()/chunk.scale + 0.5));
+            samples[2*i+1] = static_cast<int16_t>(floor(row[i].imag()/chunk.scale + 0.5));
+        }
+        const char* begin = reinterpret_cast<const char*>(samples.data());
+        payload.assign(begin, begin + samples.size()*sizeof(int16_t));
+    }
+    chunk.crc = crc32(payload.data(), payload.size(), 0);
+
+    std::lock_guard<std::mutex> lock(writeLock);
+    file.write(reinterpret_cast<const char*>(&chunk), sizeof(chunk));
+    file.write(payload.data(), payload.size());
+    file.flush();
+    if (!file && !failed) {
+        cout << "Error writing RF data chunk at frequency index " << fIndex << endl;
+        failed = true;
+    }
+    return failed ? 0 : 1;
+}
+
+int rfContainer::close() {
+    file.close();
+    return !failed && file ? 1 : 0;
+}
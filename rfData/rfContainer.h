@@ -0,0 +1,81 @@
+#ifndef RFDATA_RFCONTAINER_H_
+#define RFDATA_RFCONTAINER_H_
+
+#include <stdint.h>
+
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+#include "./util.h"
+
+/*! \brief How the samples of a chunked RF file are stored, each as a real, imaginary pair.
+ */
+enum rfSampleType {
+    rfDouble = 0,  // two doubles
+    rfFloat = 1,   // two floats
+    rfInt16 = 2    // two int16, multiplied by the scale of their chunk
+};
+
+/*! \brief The header at the start of a chunked RF file, 64 bytes.
+ *
+ * It is followed by any number of chunks, each an rfChunkHeader and then the samples of
+ * one frequency for a range of beamlines of every frame: frames x lineCount complex samples,
+ * frame changing slowest.  Chunks are in the order the frequencies finished, and a
+ * frequency that was not simulated has no chunk; its coefficients are zero.
+ */
+struct rfFileHeader {
+    char magic[8];        // "USRFDAT" and a terminating zero
+    uint32_t version;
+    uint32_t endian;      // 0x01020304 as written by the machine that wrote it
+    uint32_t sampleType;  // rfSampleType
+    uint32_t freqPoints;
+    uint32_t beamlines;
+    uint32_t frames;
+    double freqStep;      // Hz
+    char reserved[24];
+};
+
+struct rfChunkHeader {
+    uint32_t freqIndex;
+    uint32_t firstBeamline;
+    uint32_t lineCount;
+    uint32_t crc;         // CRC-32 (as zlib's crc32) of the samples that follow
+    double scale;         // int16 samples are multiplied by this, 1 otherwise
+};
+
+/*! \brief A chunked RF file, written a frequency at a time as the frequencies complete.
+ *
+ * Every chunk is flushed when written, so an interrupted run leaves a file holding all the
+ * frequencies that finished, and a reader can tell a chunk that was cut short by its
+ * checksum.  Workers can write chunks at the same time.
+ */
+class rfContainer {
+ public:
+  rfContainer();
+
+  // create the file and write its header, returns 1 on success
+  int create(const char* filename, rfSampleType type,
+             int freqPoints, int beamlines, int frames, double freqStep);
+
+  // write frequency index fIndex of beamlines first to first+count-1 of every frame,
+  // taken from fftCoef laid out as in rf_data.cpp, returns 1 on success
+  int writeChunk(const cplx* fftCoef, int fIndex, int first, int count);
+
+  // returns 1 if every chunk was written
+  int close();
+
+ private:
+  std::ofstream file;
+  std::mutex writeLock;
+  rfSampleType type;
+  int freqPoints;
+  int beamlines;
+  int frames;
+  bool failed;
+};
+
+// CRC-32 of size bytes at data, continuing from crc (0 to start)
+uint32_t crc32(const void* data, size_t size, uint32_t crc);
+
+#endif  // RFDATA_RFCONTAINER_H_
@@ -3,9 +3,24 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
+#include "./beamGeometry.h"
+#include "./checkpoint.h"
+#include "./elementKernel.h"
+#include "./fieldCache.h"
+#include "./frequencyInterpolation.h"
+#include "./postprocess.h"
+#include "./rfContainer.h"
+#include "./settings.h"
+#include "./spectrum.h"
 #include "./util.h"
 #include "./pressureField.h"
 #include "./phantom.h"
@@ -13,10 +28,317 @@
 using std::cout;
 using std::endl;
 
+/*! \brief Settings and results shared by all the frequency workers.
+ *
+ * Everything except nextFreq, completed and the fftCoef columns is read only once the
+ * frequency loop has started.  Each frequency writes only its own entries of fftCoef, so
+ * workers never write to the same coefficient.
+ *
+ * Several phantoms (frames) imaged with the same settings share each field buffer.
+ * The coefficients of frame f start at fftCoef + f*freqPoints*beamlines.
+ *
+ * With a grid chosen per frequency gridOf gives the grid of each frequency index.  The grids
+ * are imaged one after the other, and geometry holds the beam geometry of each frame on the
+ * grid being imaged.
+ */
+struct simulation {
+    std::vector<phantom*> frames;
+    std::vector<gridFactors> grids;
+    std::vector<int> gridOf;
+    std::vector<beamGeometry> geometry;
+    fieldCache* cache;  // NULL if buffers are not cached
+    rfContainer* output;  // NULL unless frequencies are written as they finish
+    int beamlines;
+    int freqPoints;
+    double freqStep;
+    cplx* fftCoef;
+
+    // the frequency indices to simulate, the others stay zero
+    std::vector<int> frequencies;
+    std::atomic<int> nextFreq;  // next entry of frequencies to be claimed
+    int gridEnd;                // one past the last entry on the grid being imaged
+    int completed;              // frequencies finished, guarded by logLock
+    std::mutex logLock;
+    time_t t0;
+
+    // With a single precision buffer, the frequency indices at which the coefficients
+    // are also summed from the double buffer, and the differences found, guarded by logLock
+    std::vector<char> checkPrecision;
+    double errorSquares;
+    double referenceSquares;
+    double largestError;
+    size_t checkedCoefs;
+
+    // Snapshots for resuming an interrupted run, NULL if none are taken.  done marks the
+    // frequency indices finished in the block of beamlines being imaged, guarded by logLock.
+    checkpoint* saver;
+    double checkpointInterval;  // seconds, 0 for no periodic snapshots
+    time_t lastCheckpoint;
+    std::vector<char> done;
+    int blockFirst;
+    int blockCount;
+
+    // With frequency interpolation the entries of frequencies are split into spans of
+    // interpolationStep and the spans into one run of consecutive spans for each of the
+    // workers, see interpolatingWorker, and nextFreq counts runs.  0 calculates every
+    // buffer.  checkInterpolation marks the frequency indices whose interpolated buffers
+    // are compared with calculated ones, which are counted by interpolationChecks and not
+    // by calculatedBuffers.  The counts are guarded by logLock.
+    int interpolationStep;
+    int workers;
+    double interpolationTolerance;
+    std::vector<char> checkInterpolation;
+    int calculatedBuffers;
+    int interpolatedBuffers;
+    int interpolationChecks;
+    double interpolationErrorSquares;
+    double largestInterpolationError;
+};
+
+/*!  Fill the buffer of pressure at frequency index fIndex, from the cache if it is there.
+ * The double values of a checked frequency are not cached.
+ */
+void fillBuffer(simulation* sim, fieldBuffer* pressure, int fIndex, bool check) {
+    double freq = fIndex*sim->freqStep;  // Hz
+    if (check || !sim->cache || !sim->cache->load(pressure, freq)) {
+        pressure->calculateBufferField(freq);
+        if (sim->cache) sim->cache->store(pressure, freq);
+    }
+}
+
+/*!  The same, counted as a buffer the simulation needed.
+ */
+void calculatedBuffer(simulation* sim, fieldBuffer* pressure, int fIndex, bool check) {
+    fillBuffer(sim, pressure, fIndex, check);
+
+    std::lock_guard<std::mutex> lock(sim->logLock);
+    sim->calculatedBuffers++;
+}
+
+/*!  Calculate the coefficients of every beamline at frequency index fIndex, using the
+ * transducer and field buffer owned by the calling worker.  An interpolated buffer has
+ * already been filled in, otherwise it is calculated here.
+ */
+void simulateFrequency(simulation* sim, fieldBuffer* pressure, int fIndex,
+                       bool interpolated) {
+    double freq = fIndex*sim->freqStep;  // Hz
+    bool check = !sim->checkPrecision.empty() && sim->checkPrecision[fIndex];
+    bool singleNearest = pressure->givePrecision() == singlePrecision &&
+                         pressure->giveInterpolation() == nearestPoint;
+    double errorSquares = 0, referenceSquares = 0, largestError = 0;
+    size_t checkedCoefs = 0;
+
+    // get the next buffer field
+    if (!interpolated)
+        calculatedBuffer(sim, pressure, fIndex, check);
+    pressure->prepareInterpolation();
+
+    // every frame is imaged with the same buffer
+    for (size_t f=0; f < sim->frames.size(); f++) {
+        double sqrtBsc = sqrt(sim->frames[f]->giveBsc(freq/1E6));
+        const beamGeometry& geometry = sim->geometry[f];
+        cplx* frameCoef = sim->fftCoef + f*sim->freqPoints*sim->beamlines;
+
+        // loop through the image lines of the current block
+        for (int i=0; i < geometry.beamlines(); i++) {
+            size_t cnt = geometry.count(i);
+            const fieldSample* samples = geometry.samples(i);
+            const cellFraction* fractions = geometry.fractions(i);
+            int line = geometry.firstBeamline() + i;
+
+            cplx& coef = frameCoef[fIndex + line*sim->freqPoints];
+
+            // loop through each scatterer in beam
+            if (singleNearest) {
+                coef += pressure->bufferSumFloat(samples, cnt)*sqrtBsc;
+            } else if (pressure->giveInterpolation() == nearestPoint) {
+                for (size_t j=0; j < cnt; j++) {
+                    // get pressure field at location
+                    cplx a0 = pressure->bufferField(samples[j]);
+                    coef += a0*sqrtBsc;
+
+                     // a0 is pi and ps, incident and
+                     //         scattered pressure multiplied
+                }
+            } else {
+                coef += pressure->interpolatedSum(samples, fractions, cnt)*sqrtBsc;
+            }
+
+            if (check) {
+                cplx reference = cplxZero;
+                for (size_t j=0; j < cnt; j++)
+                    reference += pressure->doubleField(samples[j],
+                                                      fractions ? &fractions[j] : NULL)*sqrtBsc;
+                double error = std::abs(coef - reference);
+                errorSquares += error*error;
+                referenceSquares += std::norm(reference);
+                largestError = std::max(largestError, error);
+                checkedCoefs++;
+            }
+
+            // take care of constants
+            cplx factor = freq*imUnit;
+            coef *= factor;
+        }
+    }
+
+    if (sim->output) {
+        const beamGeometry& block = sim->geometry[0];
+        sim->output->writeChunk(sim->fftCoef, fIndex,
+                                block.firstBeamline(), block.beamlines());
+    }
+
+    // track how long each iteration takes
+    std::lock_guard<std::mutex> lock(sim->logLock);
+    sim->completed++;
+    sim->errorSquares += errorSquares;
+    sim->referenceSquares += referenceSquares;
+    sim->largestError = std::max(sim->largestError, largestError);
+    sim->checkedCoefs += checkedCoefs;
+    sim->done[fIndex] = 1;
+    if (interpolated) sim->interpolatedBuffers++;
+    time_t t1 = time(NULL);
+    cout << "The backscatter coefficient at: " << freq/1E6
+         << " MHz is: " << sim->frames[0]->giveBsc(freq/1E6) << endl;
+    cout << sim->completed << '/' << sim->frequencies.size() << " completed: "
+         << freq/1e6 << "MHz" << (interpolated ? " (interpolated), " : ", ")
+         << t1-sim->t0 << " sec used" << endl;
+
+    if (sim->saver && sim->checkpointInterval > 0 &&
+        difftime(t1, sim->lastCheckpoint) >= sim->checkpointInterval) {
+        if (sim->saver->save(sim->fftCoef, sim->freqPoints, sim->beamlines,
+                             static_cast<int>(sim->frames.size()),
+                             sim->blockFirst, sim->blockCount, sim->done))
+            cout << "Checkpoint written to " << sim->saver->name() << endl;
+        sim->lastCheckpoint = time(NULL);
+    }
+}
+
+/*!  Calculate and image the buffer at an entry of sim->frequencies, and keep it as an anchor.
+ */
+double anchorBuffer(simulation* sim, fieldBuffer* pressure,
+                    frequencyInterpolator* interpolator, int entry) {
+    int fIndex = sim->frequencies[entry];
+    simulateFrequency(sim, pressure, fIndex, false);
+    interpolator->keep(fIndex*sim->freqStep);
+    return fIndex*sim->freqStep;
+}
+
+/*!  Image the entries of sim->frequencies strictly between a and m and between m and b,
+ * whose buffers the interpolator keeps.  The buffer at the entry q halfway between a and m
+ * (or m and b if there is none) is calculated and compared with the parabola through a, m
+ * and b.  If that is within the tolerance, the others are interpolated by the cubic through
+ * a, q, m and b, which is closer still.  Otherwise each half is refined the same way, the
+ * entry calculated for the check being the middle of its half.
+ */
+void refineSpan(simulation* sim, fieldBuffer* pressure,
+                frequencyInterpolator* interpolator, int a, int m, int b) {
+    int q = m - a >= 2 ? (a + m)/2 : (m + b)/2;
+    if (q == m) return;  // no entries left to interpolate
+
+    std::vector<double> through;
+    through.push_back(sim->frequencies[a]*sim->freqStep);
+    through.push_back(sim->frequencies[m]*sim->freqStep);
+    through.push_back(sim->frequencies[b]*sim->freqStep);
+    double checked = anchorBuffer(sim, pressure, interpolator, q);
+
+    if (interpolator->error(checked, through) <= sim->interpolationTolerance) {
+        through.push_back(checked);
+        for (int entry = a + 1; entry < b; entry++) {
+            if (entry == m || entry == q) continue;
+            int fIndex = sim->frequencies[entry];
+            interpolator->interpolate(fIndex*sim->freqStep, through);
+            simulateFrequency(sim, pressure, fIndex, true);
+
+            if (!sim->checkInterpolation.empty() && sim->checkInterpolation[fIndex]) {
+                fillBuffer(sim, pressure, fIndex, false);
+                double error = interpolator->error(fIndex*sim->freqStep, through);
+                std::lock_guard<std::mutex> lock(sim->logLock);
+                cout << "Interpolated buffer at " << fIndex*sim->freqStep/1e6
+                     << " MHz: relative RMS error " << error << endl;
+                sim->interpolationChecks++;
+                sim->interpolationErrorSquares += error*error;
+                sim->largestInterpolationError = std::max(sim->largestInterpolationError,
+                                                          error);
+            }
+        }
+    } else {
+        int lower[2] = {a, m}, upper[2] = {m, b};
+        for (int half = 0; half < 2; half++) {
+            int lo = lower[half], hi = upper[half];
+            if (q > lo && q < hi) {
+                refineSpan(sim, pressure, interpolator, lo, q, hi);
+            } else if (hi - lo >= 2) {
+                double middle = anchorBuffer(sim, pressure, interpolator, (lo + hi)/2);
+                refineSpan(sim, pressure, interpolator, lo, (lo + hi)/2, hi);
+                interpolator->release(middle);
+            }
+        }
+    }
+    interpolator->release(checked);
+}
+
+/*!  Claim runs of consecutive spans of interpolationStep entries of sim->frequencies until
+ * none are left.  Span s runs from entry (s-1)*step, whose buffer is only needed as an
+ * anchor, to entry s*step, and images the entries after the first.  The first span is entry
+ * 0 alone.  There is a run for each worker, so the anchor at the end of a span is kept for
+ * the start of the next one, and only the first span of a run calculates its start anchor
+ * again, or reads it from the cache if there is one.
+ */
+void interpolatingWorker(simulation* sim, fieldBuffer* pressure,
+                         frequencyInterpolator* interpolator) {
+    int entries = static_cast<int>(sim->frequencies.size());
+    int step = sim->interpolationStep;
+    int spans = entries == 0 ? 0 : (entries - 1 + step - 1)/step + 1;
+    int runs = std::min(sim->workers, spans);
+
+    for (;;) {
+        int run = sim->nextFreq++;
+        if (run >= runs) break;
+
+        for (int span = run*spans/runs; span < (run + 1)*spans/runs; span++) {
+            int a = (span - 1)*step;
+            int b = std::min(span*step, entries - 1);
+
+            if (a >= 0 && span == run*spans/runs) {
+                calculatedBuffer(sim, pressure, sim->frequencies[a], false);
+                interpolator->keep(sim->frequencies[a]*sim->freqStep);
+            }
+
+            anchorBuffer(sim, pressure, interpolator, b);
+            if (a >= 0 && b - a >= 2) {
+                double middle = anchorBuffer(sim, pressure, interpolator, (a + b)/2);
+                refineSpan(sim, pressure, interpolator, a, (a + b)/2, b);
+                interpolator->release(middle);
+            }
+            if (a >= 0)
+                interpolator->release(sim->frequencies[a]*sim->freqStep);
+        }
+        interpolator->clear();
+    }
+}
+
+/*!  Claim frequency indices until none are left.  Frequencies are handed out one at a time,
+ * so a worker that is slowed down does not hold up the others.
+ */
+void frequencyWorker(simulation* sim, fieldBuffer* pressure,
+                     frequencyInterpolator* interpolator) {
+    if (interpolator) {
+        interpolatingWorker(sim, pressure, interpolator);
+        return;
+    }
+    for (;;) {
+        int next = sim->nextFreq++;
+        if (next >= sim->gridEnd) return;
+        simulateFrequency(sim, pressure, sim->frequencies[next], false);
+    }
+}
+
 int main(int argc, char* argv[]) {
     // x is lateral, y is elevational, z is axial direction
     if (argc < 2) {
         cout << "Error! An input file is needed" << endl;
+        cout << "Usage: " << argv[0] << " inputFile [--threads N] [--resume]" << endl;
         exit(-1);
     }
 
@@ -25,8 +347,7 @@ int main(int argc, char* argv[]) {
     int count, beamlines;
     double beamspacing, spacing, transfocus, maxfreq, beamWidth;
     double machineSoundSpeed, phantomGap;
-    char phantomfile[60], outrffile[60];
-    array *transducer;
+    char phantomfiles[1024], outrffile[60];
     int success;
 
     FILE *fpinput;
@@ -76,7 +397,8 @@ int main(int argc, char* argv[]) {
 
     cout << "The maximum simulated frequency is:  " << maxfreq << endl;
     while (fgetc(fpinput) != ':') {}
-    success = fscanf(fpinput, "%s", phantomfile);
+    // a comma separated list of phantoms gives a multi-frame simulation
+    success = fscanf(fpinput, "%1023s", phantomfiles);
     assert(success == 1);
 
     while (fgetc(fpinput) != ':') {}
@@ -91,30 +413,312 @@ int main(int argc, char* argv[]) {
     success = fscanf(fpinput, "%lf", &phantomGap);
     assert(success == 1);
 
+    // everything after the required entries is optional
+    optionalSettings options;
+    options.readRemaining(fpinput);
     fclose(fpinput);
 
+    // 0 threads means one per hardware thread
+    int threads = options.getInt("Number of threads", 1);
+    bool resume = false;
+    for (int arg = 2; arg < argc; arg++) {
+        if (strcmp(argv[arg], "--threads") == 0 && arg+1 < argc) {
+            threads = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "--resume") == 0) {
+            resume = true;
+        } else {
+            cout << "Error! Unknown command line option: " << argv[arg] << endl;
+            exit(-1);
+        }
+    }
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    cout << "Using " << threads << " thread(s)" << endl;
+    cout << "Single element field kernel: " << elementKernelTarget() << endl;
 
+    // Frequencies where the transducer spectrum is below the threshold hardly
+    // contribute to the image, and are left at zero
+    transducerSpectrum spectrum;
+    std::string spectrumFile = options.getString("Transducer spectrum file", "");
+    double centerFreq = options.getDouble("Transducer center frequency(Hz)", 0);
+    double bandwidth = options.getDouble("Fractional bandwidth", 0.5);
+    double thresholdDb = options.getDouble("Spectral threshold(dB)", -60);
+    if (!spectrumFile.empty()) {
+        if (!spectrum.loadFromFile(spectrumFile.c_str()))
+            exit(-1);
+    } else if (centerFreq > 0) {
+        spectrum.setGaussian(centerFreq, bandwidth);
+    }
 
-    // Load the phantom and generate the incident pressure field
-    phantom target;
-    int loaded = target.loadPhantom(phantomfile);
-    if (!loaded) {
-    cout << "Phantom file not loaded" << endl;
-    return -1;
+    // Field buffers can be kept on disk for later runs with the same settings
+    std::string cacheDir = options.getString("Field cache directory", "");
+
+    // Phantoms larger than memory are imaged a block of beamlines at a time,
+    // with only the scatterers of those beamlines resident
+    int blockBeamlines = options.getInt("Streaming block beamlines", 0);
+    bool streaming = blockBeamlines > 0;
+    if (!streaming) blockBeamlines = beamlines;
+    if (streaming && cacheDir.empty())
+        cout << "Warning: streaming without a field cache directory calculates "
+             << "every field buffer once per block" << endl;
+
+    // Interpolating the field between grid points allows coarser grids
+    std::string interpolationName = options.getString("Field interpolation", "nearest");
+    interpolationMode interpolation = nearestPoint;
+    if (interpolationName == "trilinear") {
+        interpolation = trilinearMagPhase;
+    } else if (interpolationName == "phase corrected") {
+        interpolation = phaseCorrected;
+    } else if (interpolationName != "nearest") {
+        cout << "Error! Unknown field interpolation " << interpolationName
+             << ", use nearest, trilinear or phase corrected" << endl;
+        exit(-1);
+    }
+
+    // A comma separated list of transmit foci images each depth zone with
+    // its own focus, from one field buffer
+    std::string zoneList = options.getString("Transmit focal zones", "");
+    std::vector<double> transFoci;
+    std::vector<char> zoneText(zoneList.begin(), zoneList.end());
+    zoneText.push_back('\0');
+    for (char* item = strtok(zoneText.data(), ","); item != NULL; item = strtok(NULL, ",")) {
+        char* end;
+        double focus = strtod(item, &end);
+        if (end == item || focus <= 0) {
+            cout << "Error! Transmit focal zones must be positive depths separated by commas"
+                 << endl;
+            exit(-1);
+        }
+        transFoci.push_back(focus);
+    }
+
+    // The F numbers set the active aperture, negative for all elements, and
+    // the windows its apodization
+    double transFnum = options.getDouble("Transmit F number", -2);
+    double recFnum = options.getDouble("Receive F number", -2);
+    if (transFnum < 0)
+        cout << "Transmit F number < 0, so using all elements" << endl;
+    if (recFnum < 0)
+        cout << "Receive F number < 0, so using all elements" << endl;
+    apodizationWindow transWindow, recWindow;
+    std::string transWindowName = options.getString("Transmit apodization", "rect");
+    std::string recWindowName = options.getString("Receive apodization", "rect");
+    if (!parseApodization(transWindowName, &transWindow) ||
+        !parseApodization(recWindowName, &recWindow)) {
+        cout << "Error! Unknown apodization " << transWindowName << " or "
+             << recWindowName << ", use rect, hann or tukey" << endl;
+        exit(-1);
+    }
+    double taper = options.getDouble("Tukey taper fraction", 0.5);
+    if (taper < 0 || taper > 1) {
+        cout << "Error! The Tukey taper fraction must be between 0 and 1" << endl;
+        exit(-1);
+    }
+
+    // The field can also be propagated plane by plane with FFTs
+    std::string engineName = options.getString("Field engine", "fresnel");
+    fieldEngine engine = fresnelEngine;
+    if (engineName == "angular spectrum") {
+        engine = angularSpectrumEngine;
+    } else if (engineName != "fresnel") {
+        cout << "Error! Unknown field engine " << engineName
+             << ", use fresnel or angular spectrum" << endl;
+        exit(-1);
+    }
+
+    // Wide arrays add up their elements faster with the FFT
+    std::string superpositionName = options.getString("Element superposition", "auto");
+    superpositionMode superposition = automaticSum;
+    if (superpositionName == "direct") {
+        superposition = directSum;
+    } else if (superpositionName == "fft") {
+        superposition = fftSum;
+    } else if (superpositionName != "auto") {
+        cout << "Error! Unknown element superposition " << superpositionName
+             << ", use auto, direct or fft" << endl;
+        exit(-1);
     }
 
+    // A single precision buffer takes half the memory and is gathered faster
+    std::string precisionName = options.getString("Field precision", "double");
+    fieldPrecision precision = doublePrecision;
+    if (precisionName == "float") {
+        precision = singlePrecision;
+    } else if (precisionName != "double") {
+        cout << "Error! Unknown field precision " << precisionName
+             << ", use double or float" << endl;
+        exit(-1);
+    }
+
+    // Compare single precision with double at this many frequencies
+    int reportFrequencies = options.getInt("Precision report frequencies", 0);
+    if (reportFrequencies > 0 && precision != singlePrecision) {
+        cout << "Warning: the precision report is only made for float field precision"
+             << endl;
+        reportFrequencies = 0;
+    }
+
+    // Buffers between calculated ones can be interpolated in frequency,
+    // within a tolerance of the relative RMS error
+    int interpolationStep = options.getInt("Frequency interpolation step", 0);
+    double interpolationTolerance = options.getDouble("Frequency interpolation tolerance",
+                                                      0.01);
+    int interpolationReport = options.getInt("Interpolation check frequencies", 0);
+    if (interpolationStep < 0 || interpolationTolerance <= 0) {
+        cout << "Error! The frequency interpolation step can't be negative and "
+             << "the tolerance must be positive" << endl;
+        exit(-1);
+    }
+    if (interpolationStep < 2) interpolationStep = 0;
+    if (interpolationReport > 0 && interpolationStep == 0) {
+        cout << "Warning: the interpolation check is only made with a frequency "
+             << "interpolation step of 2 or more" << endl;
+        interpolationReport = 0;
+    }
+    if (interpolationStep > 0)
+        cout << "Interpolating field buffers over spans of " << interpolationStep
+             << " frequencies, tolerance " << interpolationTolerance << endl;
+
+    // Lower frequencies can be calculated on coarser grids
+    double pointsPerWavelength = options.getDouble("Points per wavelength", 0);
+    if (pointsPerWavelength < 0) {
+        cout << "Error! The points per wavelength can't be negative" << endl;
+        exit(-1);
+    }
+    if (pointsPerWavelength > 0 && interpolationStep > 0) {
+        cout << "Error! Frequency interpolation needs the same grid at every frequency, "
+             << "so it can't be used with points per wavelength" << endl;
+        exit(-1);
+    }
+
+    // The chunked format writes each frequency as it finishes
+    std::string formatName = options.getString("RF output format", "legacy");
+    std::string sampleName = options.getString("RF sample type", "double");
+    bool chunked = formatName == "chunked";
+    rfSampleType sampleType = rfDouble;
+    if (formatName != "legacy" && !chunked) {
+        cout << "Error! Unknown RF output format " << formatName
+             << ", use legacy or chunked" << endl;
+        exit(-1);
+    }
+    if (sampleName == "float") {
+        sampleType = rfFloat;
+    } else if (sampleName == "int16") {
+        sampleType = rfInt16;
+    } else if (sampleName != "double") {
+        cout << "Error! Unknown RF sample type " << sampleName
+             << ", use double, float or int16" << endl;
+        exit(-1);
+    }
+    if (!chunked && sampleType != rfDouble)
+        cout << "Warning: the legacy RF output format is always double" << endl;
+
+    // Snapshots of the finished frequencies, for --resume
+    double checkpointInterval = options.getDouble("Checkpoint interval(s)", 0);
+    std::string checkpointFile = options.getString("Checkpoint file",
+                                                   std::string(outrffile) + ".checkpoint");
+    bool checkpointing = checkpointInterval > 0 || resume;
+
+    // Time domain RF lines and B-mode images, as binary2matrix.m makes them
+    std::string rfLineFile = options.getString("RF line output file", "");
+    std::string bmodeFile = options.getString("B-mode output file", "");
+    int upsample = options.getInt("Time upsampling factor", 3);
+    double dynamicRangeDb = options.getDouble("B-mode dynamic range(dB)", 60);
+    bool timeDomain = !rfLineFile.empty() || !bmodeFile.empty();
+    if (timeDomain && (upsample < 1 || dynamicRangeDb <= 0)) {
+        cout << "Error! The time upsampling factor must be at least 1 and the "
+             << "B-mode dynamic range positive" << endl;
+        exit(-1);
+    }
+    if (timeDomain && !spectrum.isSet())
+        cout << "Warning: without a transducer spectrum the RF lines are "
+             << "not weighted by a pulse spectrum" << endl;
+
+    options.warnUnused();
+
+
+    // Load the phantoms and generate the incident pressure field
+    // a checkpoint is only used with the input file and phantoms it was taken of
+    uint64_t inputHash = hashSeed, phantomHash = hashSeed;
+    if (checkpointing && !hashFile(argv[1], &inputHash)) {
+        cout << "Error! Can't read input file " << argv[1] << endl;
+        return -1;
+    }
+
+    std::vector<phantom*> frames;
+    for (char* name = strtok(phantomfiles, ","); name != NULL;
+                                                 name = strtok(NULL, ",")) {
+        if (checkpointing && !hashFile(name, &phantomHash)) {
+            cout << "Phantom file not loaded" << endl;
+            return -1;
+        }
+        phantom* frame = new phantom;
+        int loaded = streaming ? frame->openStreaming(name)
+                               : frame->loadPhantom(name);
+        if (!loaded) {
+        cout << "Phantom file not loaded" << endl;
+        return -1;
+        }
+        frames.push_back(frame);
+    }
+    phantom& target = *frames[0];
+
+    // the field buffer is calculated for the first frame and used for all
+    for (size_t f = 1; f < frames.size(); f++) {
+        if (!target.sameMedium(*frames[f])) {
+            cout << "Error! Frame " << f << " differs in size, sound speed or "
+                 << "attenuation from the first frame" << endl;
+            return -1;
+        }
+    }
+    int numFrames = static_cast<int>(frames.size());
+    if (numFrames > 1)
+        cout << "Simulating " << numFrames << " frames" << endl;
+
 
     // Initialize a class for holding transducer information,
-    //                           pressure field, fresnel integral
-    transducer = new array(geom, spacing, count, machineSoundSpeed);
-    assert(transducer != NULL);
-    fieldBuffer pressure(transfocus,
-                         beamWidth,
-                         step,
-                         &target,
-                         machineSoundSpeed,
-                         transducer,
-                         phantomGap);
+    //                           pressure field, fresnel integral.
+    // Each worker thread gets its own, as calculateBufferField changes the
+    // focusing of the transducer and overwrites the buffer.
+    std::vector<array*> transducers(threads);
+    std::vector<fieldBuffer*> pressures(threads);
+    std::vector<frequencyInterpolator*> interpolators(threads, NULL);
+    for (int t = 0; t < threads; t++) {
+        transducers[t] = new array(geom, spacing, count, machineSoundSpeed);
+        assert(transducers[t] != NULL);
+        transducers[t]->setTrsFnum(transFnum);
+        transducers[t]->setRecFnum(recFnum);
+        transducers[t]->setTrsApodization(transWindow);
+        transducers[t]->setRecApodization(recWindow);
+        transducers[t]->setTaper(taper);
+        pressures[t] = new fieldBuffer(transfocus,
+                                       beamWidth,
+                                       step,
+                                       &target,
+                                       machineSoundSpeed,
+                                       transducers[t],
+                                       phantomGap);
+        pressures[t]->setInterpolation(interpolation);
+        pressures[t]->setEngine(engine);
+        pressures[t]->setPointsPerWavelength(pointsPerWavelength);
+        pressures[t]->setSuperposition(superposition);
+        pressures[t]->setTransmitZones(transFoci);
+        pressures[t]->setPrecision(precision, reportFrequencies > 0);
+        if (interpolationStep > 0)
+            interpolators[t] = new frequencyInterpolator(pressures[t]);
+    }
+    fieldBuffer& pressure = *pressures[0];
+
+    const std::vector<double>& zones = pressure.giveTransmitZones();
+    for (size_t i = 0; i < zones.size(); i++) {
+        cout << "Transmit zone " << i+1 << ": focus " << zones[i];
+        if (i + 1 < zones.size())
+            cout << " up to a depth of " << (zones[i] + zones[i+1])/2;
+        cout << endl;
+    }
+
+    if (engine == angularSpectrumEngine)
+        cout << "Field engine: angular spectrum" << endl;
 
     /* ----------------[ Calculate the image FFT ]--------------------------*/
 
@@ -126,7 +730,8 @@ int main(int argc, char* argv[]) {
     double freqStep = maxfreq/freqPoints;
 
     // initialize the coef matrix
-    cplx* fftCoef = new cplx[freqPoints*beamlines];
+    size_t frameSize = static_cast<size_t>(freqPoints)*beamlines;
+    cplx* fftCoef = new cplx[numFrames*frameSize];
     assert(fftCoef != NULL);
 
 
@@ -136,99 +741,295 @@ int main(int argc, char* argv[]) {
     myVector phanSize(0.0, 0.0, 0.0);
     phanSize = target.getPhanSize();
 
-    // Need to be sure scatterers are sorted before imaging is performed
-    target.sortScatterer();
+    simulation sim;
+    sim.frames = frames;
+
     // set to 0
-    for (int fp=0; fp < freqPoints; fp++) {
-        for (int il=0; il < beamlines; il++) {
-                fftCoef[fp +il*freqPoints] = cplxZero;
+    for (size_t k=0; k < numFrames*frameSize; k++)
+        fftCoef[k] = cplxZero;
+
+    sim.cache = cacheDir.empty() ? NULL : new fieldCache(cacheDir);
+    sim.output = NULL;
+    if (chunked) {
+        sim.output = new rfContainer;
+        if (!sim.output->create(outrffile, sampleType,
+                                freqPoints, beamlines, numFrames, freqStep))
+            exit(EXIT_FAILURE);
+    }
+    sim.beamlines = beamlines;
+    sim.freqPoints = freqPoints;
+    sim.freqStep = freqStep;
+    sim.fftCoef = fftCoef;
+    // skip DC frequency as contribution is zero there
+    std::vector<int> bandFrequencies;
+    for (int fIndex=1; fIndex < freqPoints; fIndex++) {
+        if (spectrum.inBand(fIndex*freqStep, thresholdDb))
+            bandFrequencies.push_back(fIndex);
+    }
+    cout << "Simulating " << bandFrequencies.size() << " of " << freqPoints
+         << " frequencies" << endl;
+
+    // the grids of the frequencies, from the finest at the top of the band
+    sim.gridOf.assign(freqPoints, 0);
+    for (int k = static_cast<int>(bandFrequencies.size()) - 1; k >= 0; k--) {
+        int fIndex = bandFrequencies[k];
+        gridFactors grid = pressure.gridFor(fIndex*freqStep);
+        if (sim.grids.empty() || !(grid == sim.grids.back())) {
+            sim.grids.push_back(grid);
+            if (pointsPerWavelength > 0) {
+                pressure.useGrid(grid);
+                vector gridStep = pressure.giveStep();
+                cout << "Field grid " << sim.grids.size() << " from "
+                     << fIndex*freqStep/1e6 << " MHz down: steps " << gridStep.x
+                     << ", " << gridStep.y << ", " << gridStep.z << endl;
+            }
         }
+        sim.gridOf[fIndex] = static_cast<int>(sim.grids.size()) - 1;
     }
+    if (sim.grids.empty())
+        sim.grids.push_back(pressure.gridFor(0));
+    sim.geometry.resize(numFrames);
 
-    time_t t0, t1;
-    t0 = time(NULL);
+    // carry on from the last checkpoint, rewriting its frequencies to a chunked file
+    sim.saver = checkpointing ? new checkpoint(checkpointFile, inputHash, phantomHash)
+                              : NULL;
+    sim.checkpointInterval = checkpointInterval;
+    int resumeFirst = 0, resumeCount = 0;
+    std::vector<char> resumeDone(freqPoints, 0);
+    if (resume) {
+        if (!sim.saver->load(fftCoef, freqPoints, beamlines, numFrames,
+                             &resumeFirst, &resumeCount, &resumeDone))
+            exit(-1);
+        if (resumeFirst % blockBeamlines != 0 ||
+            resumeCount != std::min(blockBeamlines, beamlines - resumeFirst)) {
+            cout << "Error! Checkpoint " << checkpointFile
+                 << " was taken with different blocks of beamlines" << endl;
+            exit(-1);
+        }
 
-    // loop through freq domain, skip DC frequency as contribution is zero there
-    for (int fIndex=1; fIndex < freqPoints; fIndex++) {
-        double freq = fIndex*freqStep;  // Hz
-        cout << "The backscatter coefficient at: " << freq/1E6
-             << " MHz is: " << target.giveBsc(freq/1E6) << endl;
-
-        // get the next buffer field
-        pressure.calculateBufferField(freq);
-        vector loc;
-        // loop through image lines
-        for (int i=0; i < beamlines; i++) {
-            // left end, right end, and center of beam
-            double leftEnd = i*beamspacing;
-            double rightEnd = leftEnd + beamWidth;
-            // double beamCenter = (leftEnd + rightEnd)/2;
-            scatterer *pos;
-            int cnt = target.getScattersBetween(leftEnd, rightEnd, &pos);
+        int finished = 0;
+        for (size_t k = 0; k < bandFrequencies.size(); k++) {
+            int fIndex = bandFrequencies[k];
+            if (resumeDone[fIndex]) finished++;
+            if (!sim.output) continue;
+            if (resumeFirst > 0)
+                sim.output->writeChunk(fftCoef, fIndex, 0, resumeFirst);
+            if (resumeDone[fIndex])
+                sim.output->writeChunk(fftCoef, fIndex, resumeFirst, resumeCount);
+        }
+        cout << "Resuming at beamline " << resumeFirst << " with " << finished
+             << " frequencies of its block finished" << endl;
+    }
 
-            // loop through each scatterer in beam
-            for (int j=0; j < cnt; j++) {
-                loc = pressure.phantomCoordinateToPressureCoordinate(pos[j], i);
-                // get pressure field at location
-                cplx a0 = pressure.bufferField(loc);
-                fftCoef[fIndex + i*freqPoints] +=
-                                     a0*sqrt(target.giveBsc(freq/1E6) );
-
-                 // a0 is pi and ps, incident and
-                 //         scattered pressure multiplied
+    // the checked frequencies are spread evenly over the band
+    sim.errorSquares = sim.referenceSquares = sim.largestError = 0;
+    sim.checkedCoefs = 0;
+    if (reportFrequencies > 0 && !bandFrequencies.empty()) {
+        size_t checks = std::min<size_t>(reportFrequencies, bandFrequencies.size());
+        sim.checkPrecision.assign(freqPoints, 0);
+        for (size_t k = 0; k < checks; k++) {
+            size_t entry = (2*k + 1)*bandFrequencies.size()/(2*checks);
+            sim.checkPrecision[bandFrequencies[entry]] = 1;
+        }
+    }
+
+    sim.interpolationStep = interpolationStep;
+    sim.workers = threads;
+    sim.interpolationTolerance = interpolationTolerance;
+    sim.calculatedBuffers = sim.interpolatedBuffers = sim.interpolationChecks = 0;
+    sim.interpolationErrorSquares = sim.largestInterpolationError = 0;
+    if (interpolationReport > 0 && !bandFrequencies.empty()) {
+        size_t checks = std::min<size_t>(interpolationReport, bandFrequencies.size());
+        sim.checkInterpolation.assign(freqPoints, 0);
+        for (size_t k = 0; k < checks; k++) {
+            size_t entry = (2*k + 1)*bandFrequencies.size()/(2*checks);
+            sim.checkInterpolation[bandFrequencies[entry]] = 1;
+        }
+    }
+    sim.t0 = time(NULL);
+    sim.lastCheckpoint = sim.t0;
+
+    // Without streaming there is a single block holding every beamline
+    for (int first = resumeFirst; first < beamlines; first += blockBeamlines) {
+        int blockSize = std::min(blockBeamlines, beamlines - first);
+
+        // only the frequencies not finished before a resume are left to do
+        sim.blockFirst = first;
+        sim.blockCount = blockSize;
+        if (first == resumeFirst)
+            sim.done = resumeDone;
+        else
+            sim.done.assign(freqPoints, 0);
+        sim.frequencies.clear();
+        for (size_t k = 0; k < bandFrequencies.size(); k++) {
+            if (!sim.done[bandFrequencies[k]])
+                sim.frequencies.push_back(bandFrequencies[k]);
+        }
+
+        if (streaming)
+            cout << "Imaging beamlines " << first << " to "
+                 << first + blockSize - 1 << endl;
+
+        for (int f = 0; f < numFrames; f++) {
+            if (streaming) {
+                int64_t resident = frames[f]->loadWindow(
+                                 first*beamspacing,
+                                 (first + blockSize - 1)*beamspacing + beamWidth);
+                if (resident < 0)
+                    return -1;
+                cout << resident << " scatterers resident" << endl;
             }
 
-            // take care of constants
-            cplx factor = freq*imUnit;
-            fftCoef[fIndex + i*freqPoints] *= factor;
+            // Need to be sure scatterers are sorted before imaging is performed
+            frames[f]->sortScatterer();
+        }
+        sim.completed = 0;
+
+        // The frequencies of each grid are a run of entries of frequencies.  The
+        // grids are imaged one at a time from the coarsest, at the bottom of the
+        // band, so only the beam geometry and field buffers of one grid are held.
+        int end = 0;
+        for (int g = static_cast<int>(sim.grids.size()) - 1; g >= 0; g--) {
+            int begin = end;
+            while (end < static_cast<int>(sim.frequencies.size()) &&
+                   sim.gridOf[sim.frequencies[end]] == g)
+                end++;
+            if (begin == end) continue;
+
+            // Which scatterers are in each beam, and where they are in the field
+            // buffer, is the same at every frequency of a grid
+            pressure.useGrid(sim.grids[g]);
+            for (int f = 0; f < numFrames; f++)
+                sim.geometry[f].build(frames[f], &pressure,
+                                      first, blockSize, beamspacing, beamWidth);
+
+            // with frequency interpolation there is one grid and nextFreq counts runs
+            sim.nextFreq = begin;
+            sim.gridEnd = end;
+
+            // loop through freq domain, the calling thread acts as the first worker
+            std::vector<std::thread> workers;
+            for (int t = 1; t < threads; t++)
+                workers.push_back(std::thread(frequencyWorker, &sim, pressures[t],
+                                              interpolators[t]));
+            frequencyWorker(&sim, pressures[0], interpolators[0]);
+            for (size_t t = 0; t < workers.size(); t++)
+                workers[t].join();
         }
+        assert(end == static_cast<int>(sim.frequencies.size()));
+    }
+
+    long fftRows = 0, directRows = 0;
+    for (int t = 0; t < threads; t++) {
+        fftRows += pressures[t]->fftSuperposedRows();
+        directRows += pressures[t]->directSuperposedRows();
+    }
+    if (fftRows > 0)
+        cout << "Elements added up with the FFT in " << fftRows << " of "
+             << fftRows + directRows << " field buffer rows" << endl;
+
+    if (interpolationStep > 0) {
+        cout << "Field buffers calculated " << sim.calculatedBuffers
+             << " times and interpolated at " << sim.interpolatedBuffers
+             << " frequencies";
+        if (sim.interpolationChecks > 0)
+            cout << ", and calculated " << sim.interpolationChecks
+                 << " more times to check the interpolation";
+        cout << endl;
+    }
+    if (sim.interpolationChecks > 0) {
+        cout << "Frequency interpolation error at " << sim.interpolationChecks
+             << " frequencies: relative RMS " << sqrt(sim.interpolationErrorSquares/
+                                                      sim.interpolationChecks)
+             << ", largest " << sim.largestInterpolationError
+             << " (tolerance " << interpolationTolerance << ")" << endl;
+    }
+
+    for (int t = 0; t < threads; t++) {
+        delete interpolators[t];
+        delete pressures[t];
+        delete transducers[t];
+    }
+    delete sim.cache;
 
-        // track how long each iteration takes
-        t1 = time(NULL);
-        cout << (fIndex+1) << '/' << freqPoints << " completed: "
-             << freq/1e6 << "MHz, " << t1-t0 << " sec used" << endl;
+    if (sim.checkedCoefs > 0) {
+        double rms = sqrt(sim.referenceSquares/sim.checkedCoefs);
+        cout << "Single precision error over " << sim.checkedCoefs << " coefficients: "
+             << "relative RMS " << sqrt(sim.errorSquares/sim.referenceSquares)
+             << ", largest " << (rms > 0 ? sim.largestError/rms : 0)
+             << " of the RMS coefficient" << endl;
     }
 
     /* ----------------[ SAVE OUTPUT ]--------------------------*/
-    std::ofstream fp(outrffile, std::ios::binary);
-
-    if ( !fp.is_open() ) {
-           cout << "Failure to write RF data file named: "
-                << outrffile << endl;
-
-           exit(EXIT_FAILURE);
-        }
-
-    /* First write the freq step,
-                       number of points,
-                       number of lines as double,
-                       int, int
-    */
-    fp.write( reinterpret_cast<char*>(&freqStep), sizeof(double) );
-    fp.write( reinterpret_cast<char*>(&freqPoints), sizeof(int) );
-    fp.write( reinterpret_cast<char*>(&beamlines), sizeof(int) );
-
-    double *realSignal = new double[freqPoints*beamlines];
-    double *imagSignal = new double[freqPoints*beamlines];
-
-    for (int j=0; j < beamlines; j++) {
-            int k;
-            realSignal[0 + j*freqPoints] = 0.0;
-            imagSignal[0 + j*freqPoints] = 0.0;
-            for (k=0; k < freqPoints; k++) {
-                realSignal[k + j*freqPoints] = fftCoef[k + j*freqPoints].real();
-                imagSignal[k + j*freqPoints] = fftCoef[k + j*freqPoints].imag();
+    if (sim.output) {
+        // every frequency has already been written
+        int written = sim.output->close();
+        delete sim.output;
+        if (!written) exit(EXIT_FAILURE);
+    } else {
+        std::ofstream fp(outrffile, std::ios::binary);
+
+        if ( !fp.is_open() ) {
+               cout << "Failure to write RF data file named: "
+                    << outrffile << endl;
+
+               exit(EXIT_FAILURE);
+            }
+
+        /* First write the freq step,
+                           number of points,
+                           number of lines as double,
+                           int, int
+           and for more than one frame the number of frames as int, the header
+           written by makeMultiFrameSimFile in binary2Array.py.
+           Then the real and imaginary parts of each frame in turn.
+        */
+        fp.write( reinterpret_cast<char*>(&freqStep), sizeof(double) );
+        fp.write( reinterpret_cast<char*>(&freqPoints), sizeof(int) );
+        fp.write( reinterpret_cast<char*>(&beamlines), sizeof(int) );
+        if (numFrames > 1)
+            fp.write( reinterpret_cast<char*>(&numFrames), sizeof(int) );
+
+        // the parts are split out a piece at a time rather than into
+        // full size copies of fftCoef
+        const size_t pieceSize = 1 << 16;
+        std::vector<double> piece(pieceSize);
+
+        for (int f=0; f < numFrames; f++) {
+            const cplx* frameCoef = fftCoef + f*frameSize;
+            for (int part=0; part < 2; part++) {
+                for (size_t first=0; first < frameSize; first += pieceSize) {
+                    size_t count = std::min(pieceSize, frameSize - first);
+                    for (size_t k=0; k < count; k++)
+                        piece[k] = part == 0 ? frameCoef[first + k].real()
+                                             : frameCoef[first + k].imag();
+                    fp.write(reinterpret_cast<char*>(piece.data()),
+                             sizeof(double)*count);
+                }
             }
         }
+        fp.close();
+    }
 
+    // the output is complete, so the snapshot is no longer needed
+    if (sim.saver) {
+        sim.saver->remove();
+        delete sim.saver;
+    }
 
-    fp.write(reinterpret_cast<char*>(realSignal),
-                         sizeof(double)*freqPoints*beamlines);
+    if (timeDomain) {
+        rfImage image(freqPoints, beamlines, freqStep, upsample);
+        for (int f=0; f < numFrames; f++)
+            image.addFrame(fftCoef + f*frameSize, spectrum, threads);
+        cout << "Made " << image.samples() << " samples per beamline at "
+             << image.sampleRate()/1E6 << " MHz" << endl;
 
-    fp.write(reinterpret_cast<char*>(imagSignal),
-                         sizeof(double)*freqPoints*beamlines);
-    fp.close();
-    delete[] realSignal;
-    delete[] imagSignal;
-    delete transducer;
+        if (!rfLineFile.empty() && !image.writeRf(rfLineFile.c_str()))
+            exit(EXIT_FAILURE);
+        if (!bmodeFile.empty() && !image.writeBmode(bmodeFile.c_str(), dynamicRangeDb))
+            exit(EXIT_FAILURE);
+    }
+    delete[] fftCoef;
+    for (int f=0; f < numFrames; f++)
+        delete frames[f];
 }
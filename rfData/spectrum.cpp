@@ -0,0 +1,110 @@
+#include "./spectrum.h"
+
+#include <math.h>
+#include <assert.h>
+
+#include <fstream>
+#include <iostream>
+
+using std::cout;
+using std::endl;
+
+transducerSpectrum::transducerSpectrum(): type(NONE),
+                                          centerFreq(0.0),
+                                          alpha(0.0),
+                                          tableStep(0.0),
+                                          table(NULL),
+                                          tableSize(0)
+{}
+
+transducerSpectrum::~transducerSpectrum() {
+    delete[] table;
+}
+
+/*!  Use a Gaussian spectrum, the same one binary2matrix.m applies to the simulated data.
+ */
+void transducerSpectrum::setGaussian(double center, double bandwidth) {
+    assert(center > 0 && bandwidth > 0);
+    type = GAUSSIAN;
+    centerFreq = center;
+    alpha = 4*log(2)/(center*center*bandwidth*bandwidth);
+}
+
+/*!  Read a tabulated spectrum.  The file is binary, all numbers are doubles, and it has the
+ * same layout as a backscatter coefficient file:
+ * frequency spacing (MHz)
+ * number of points
+ * list of magnitudes, starting at 0 Hz
+ *
+ * Frequencies past the end of the table have a magnitude of zero.
+ */
+int transducerSpectrum::loadFromFile(const char* fname) {
+    std::ifstream specFile(fname, std::ios::binary);
+    if (!specFile.is_open()) {
+        cout << "Error opening transducer spectrum file named: " << fname << endl;
+        return 0;
+    }
+
+    double stepMHz, points;
+    specFile.read(reinterpret_cast<char*>(&stepMHz), sizeof(double));
+    specFile.read(reinterpret_cast<char*>(&points), sizeof(double));
+    tableSize = static_cast<int>(points);
+    if (!specFile || stepMHz <= 0 || tableSize < 2) {
+        cout << "Invalid transducer spectrum file: " << fname << endl;
+        return 0;
+    }
+    tableStep = stepMHz*1E6;
+
+    delete[] table;
+    table = new double[tableSize];
+    specFile.read(reinterpret_cast<char*>(table), sizeof(double)*tableSize);
+    if (!specFile) {
+        cout << "Transducer spectrum file is too short: " << fname << endl;
+        return 0;
+    }
+
+    // normalize to a peak of one
+    double peak = 0;
+    for (int i = 0; i < tableSize; i++) {
+        table[i] = fabs(table[i]);
+        if (table[i] > peak) peak = table[i];
+    }
+    if (peak <= 0) {
+        cout << "Transducer spectrum is zero everywhere: " << fname << endl;
+        return 0;
+    }
+    for (int i = 0; i < tableSize; i++)
+        table[i] /= peak;
+
+    type = TABLE;
+    return 1;
+}
+
+/*!  Return the normalized spectrum magnitude at frequency freq (Hz).  The tabulated spectrum
+ * is linearly interpolated.
+ */
+double transducerSpectrum::magnitude(double freq) const {
+    switch (type) {
+    case GAUSSIAN:
+        return exp(-alpha*(freq - centerFreq)*(freq - centerFreq));
+
+    case TABLE: {
+        double pos = freq/tableStep;
+        if (pos < 0 || pos >= tableSize - 1) return 0.0;
+        int lowInd = static_cast<int>(pos);
+        double remainder = pos - lowInd;
+        return table[lowInd] + remainder*(table[lowInd+1] - table[lowInd]);
+    }
+
+    default:
+        return 1.0;
+    }
+}
+
+/*!  Decide whether frequency freq has to be simulated.  thresholdDb is the lowest magnitude,
+ * relative to the peak, that still counts, e.g. -60.
+ */
+bool transducerSpectrum::inBand(double freq, double thresholdDb) const {
+    if (type == NONE) return true;
+    return magnitude(freq) >= pow(10.0, thresholdDb/20);
+}
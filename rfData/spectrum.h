@@ -0,0 +1,41 @@
+#ifndef RFDATA_SPECTRUM_H_
+#define RFDATA_SPECTRUM_H_
+
+/*! \brief The magnitude spectrum of the transducer pulse, used to decide which frequencies
+ * are worth simulating.
+ *
+ * The spectrum is either the Gaussian used by binary2matrix.m, given by a center frequency
+ * and a fractional bandwidth, or a table read from a file.  Magnitudes are normalized so the
+ * peak is 1.  Without a spectrum every frequency is simulated.
+ */
+class transducerSpectrum {
+ public:
+  transducerSpectrum();
+  ~transducerSpectrum();
+
+  // (center frequency in Hz, fractional -6 dB bandwidth)
+  void setGaussian(double centerFreq, double bandwidth);
+
+  // read a tabulated spectrum, returns 0 on failure
+  int loadFromFile(const char* fname);
+
+  bool isSet() const { return type != NONE; }
+
+  // normalized magnitude at frequency freq (Hz)
+  double magnitude(double freq) const;
+
+  // true if the magnitude at freq is at least thresholdDb (<= 0) below the peak
+  bool inBand(double freq, double thresholdDb) const;
+
+ private:
+  enum spectrumType { NONE, GAUSSIAN, TABLE };
+  spectrumType type;
+
+  double centerFreq, alpha;  // Gaussian spectrum
+
+  double tableStep;  // tabulated spectrum, frequency spacing in Hz
+  double* table;
+  int tableSize;
+};
+
+#endif  // RFDATA_SPECTRUM_H_
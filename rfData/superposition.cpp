@@ -0,0 +1,161 @@
+#include "./superposition.h"
+
+#include <math.h>
+#include <assert.h>
+
+#include <algorithm>
+
+namespace {
+
+// Cost of a transform of length n per n log2(n), in the time of one complex multiply and
+// add of the direct sum.  Measured on x86-64 with 64 to 256 element arrays.
+const double transformCost = 1.4;
+
+double log2Cost(int n) {
+    return transformCost*n*log2(static_cast<double>(n));
+}
+
+}  // namespace
+
+elementSuperposition::elementSuperposition(int length, int points, int space, int count)
+    : rowLength(length),
+      outputs(points),
+      spacing(space),
+      elements(count),
+      mode(automaticSum),
+      fftCount(0),
+      directCount(0),
+      plan(NULL) {
+    assert(spacing > 0 && elements > 0);
+    assert(outputs + spacing*(elements - 1) <= rowLength);
+
+    std::vector<cplx> ones(elements, cplx(1.0, 0.0));
+    setTransmitWeights(ones.data());
+    setReceiveWeights(ones.data());
+
+    // every spacing-th point of a row, from the first
+    int longest = (rowLength + spacing - 1)/spacing;
+    fftLength = 1;
+    while (fftLength < longest) fftLength *= 2;
+}
+
+elementSuperposition::~elementSuperposition() {
+    delete plan;
+}
+
+void elementSuperposition::setWeights(const cplx* weights, weightSet* set) {
+    set->weight.assign(weights, weights + elements);
+
+    int first = 0;
+    while (first < elements && weights[first] == cplxZero) first++;
+    int last = elements;
+    while (last > first && weights[last-1] == cplxZero) last--;
+    set->first = first;
+    set->count = last - first;
+    set->spectrumValid = false;
+}
+
+/*!  The direct sums take a complex multiply and add per point and active element.  The FFT
+ * takes a forward transform of each of the spacing subsequences of each distinct row,
+ * and a product and an inverse transform for transmit and for receive.
+ */
+bool elementSuperposition::fftIsCheaper(bool sharedRow) const {
+    double direct = static_cast<double>(outputs)*(transmit.count + receive.count);
+    int transforms = (sharedRow ? 1 : 2) + 2;
+    double fft = spacing*(transforms*log2Cost(fftLength) + 2.0*fftLength);
+    return fft < direct;
+}
+
+void elementSuperposition::sum(const cplx* transRow, const cplx* recRow,
+                               cplx* transOut, cplx* recOut) {
+    bool useFft = mode == fftSum ||
+                  (mode == automaticSum && fftIsCheaper(transRow == recRow));
+    if (useFft) {
+        fftSumRows(transRow, recRow, transOut, recOut);
+        fftCount++;
+    } else {
+        directSumRow(transRow, transmit, transOut);
+        directSumRow(recRow, receive, recOut);
+        directCount++;
+    }
+}
+
+/*!  The products are written out in real arithmetic, which is what std::complex does
+ * for numbers that are not infinite or NaN, without the checks that keep the loop from
+ * being optimized.  Elements outside the active span have zero weight and are skipped.
+ */
+void elementSuperposition::directSumRow(const cplx* row, const weightSet& set,
+                                        cplx* out) const {
+    const double* values = reinterpret_cast<const double*>(row);
+    const double* weights = reinterpret_cast<const double*>(set.weight.data());
+
+    for (int i = 0; i < outputs; i++) {
+        double re = 0, im = 0;
+        for (int j = set.first; j < set.first + set.count; j++) {
+            const double* v = values + 2*(i + j*spacing);
+            const double* w = weights + 2*j;
+            re += v[0]*w[0] - v[1]*w[1];
+            im += v[0]*w[1] + v[1]*w[0];
+        }
+        out[i] = cplx(re, im);
+    }
+}
+
+void elementSuperposition::fftSumRows(const cplx* transRow, const cplx* recRow,
+                                      cplx* transOut, cplx* recOut) {
+    if (!plan) {
+        plan = new fftPlan(fftLength);
+        rowSpectrum.resize(fftLength);
+        work.resize(fftLength);
+    }
+    if (!transmit.spectrumValid) spectrumOf(&transmit);
+    if (!receive.spectrumValid) spectrumOf(&receive);
+
+    for (int offset = 0; offset < spacing; offset++) {
+        transformRow(transRow, offset);
+        filterRow(transmit, offset, transOut);
+        if (recRow != transRow) transformRow(recRow, offset);
+        filterRow(receive, offset, recOut);
+    }
+}
+
+/*!  Point m of the correlation with the weights of elements first to first+count-1 is point
+ * m+count-1 of the convolution with them reversed.  The transform is at least as long as
+ * the row, so the wrap around of the circular convolution only reaches points before
+ * count-1, which are not used.
+ */
+void elementSuperposition::spectrumOf(weightSet* set) {
+    set->spectrum.assign(fftLength, cplxZero);
+    for (int k = 0; k < set->count; k++)
+        set->spectrum[k] = set->weight[set->first + set->count - 1 - k];
+    plan->transform(set->spectrum.data(), false);
+    for (int k = 0; k < fftLength; k++)
+        set->spectrum[k] /= static_cast<double>(fftLength);
+    set->spectrumValid = true;
+}
+
+// the transform of every spacing-th point of row, from point offset
+void elementSuperposition::transformRow(const cplx* row, int offset) {
+    int t = 0;
+    for (int i = offset; i < rowLength; i += spacing)
+        rowSpectrum[t++] = row[i];
+    std::fill(rowSpectrum.begin() + t, rowSpectrum.end(), cplxZero);
+    plan->transform(rowSpectrum.data(), false);
+}
+
+// the outputs offset, offset+spacing, ... from the last transformed row
+void elementSuperposition::filterRow(const weightSet& set, int offset, cplx* out) {
+    if (set.count == 0) {
+        for (int i = offset; i < outputs; i += spacing)
+            out[i] = cplxZero;
+        return;
+    }
+
+    for (int k = 0; k < fftLength; k++)
+        work[k] = rowSpectrum[k]*set.spectrum[k];
+    plan->transform(work.data(), true);
+
+    int shift = set.first + set.count - 1;
+    for (int i = offset, m = 0; i < outputs; i += spacing, m++)
+        out[i] = work[m + shift];
+}
@@ -0,0 +1,84 @@
+#ifndef RFDATA_SUPERPOSITION_H_
+#define RFDATA_SUPERPOSITION_H_
+
+#include <vector>
+
+#include "./fft.h"
+#include "./util.h"
+
+/*! \brief How the single element fields of a row are added up into the array field.
+ *
+ * directSum adds up every element at every point.  fftSum does the same sums as
+ * convolutions with the fast Fourier transform.  automaticSum picks whichever is cheaper
+ * for each row from the number of points and active elements.
+ */
+enum superpositionMode {
+    directSum,
+    fftSum,
+    automaticSum
+};
+
+/*! \brief The transmit and receive array fields along a row of the field buffer, from the
+ * single element fields along a longer row.
+ *
+ * Element j, of elements spaced spacing points apart, adds row[i + j*spacing]*weight[j] at
+ * point i.  Only the span of elements with non-zero weights is summed.  Taking every
+ * spacing-th point, starting at each of the first spacing points, turns the sums into
+ * convolutions with the reversed weights, which the FFT does in O(n log n).  The forward
+ * transforms of a row are shared by transmit and receive when they have the same row.
+ */
+class elementSuperposition {
+ public:
+  elementSuperposition(int rowLength, int outputs, int spacing, int elements);
+  ~elementSuperposition();
+
+  void setMode(superpositionMode m) { mode = m; }
+  superpositionMode giveMode() { return mode; }
+
+  // the element weights, set again whenever they change
+  void setTransmitWeights(const cplx* weights) { setWeights(weights, &transmit); }
+  void setReceiveWeights(const cplx* weights) { setWeights(weights, &receive); }
+
+  // the transmit field from transRow and the receive field from recRow, at
+  // the first outputs points.  The rows may be the same array.
+  void sum(const cplx* transRow, const cplx* recRow, cplx* transOut, cplx* recOut);
+
+  // rows added up with the FFT and directly so far
+  long fftRows() const { return fftCount; }
+  long directRows() const { return directCount; }
+
+ private:
+  struct weightSet {
+      std::vector<cplx> weight;
+      int first;                   // first element with a non-zero weight
+      int count;                   // elements from there to the last non-zero one
+      std::vector<cplx> spectrum;  // transform of the reversed span, scaled by 1/N
+      bool spectrumValid;          // spectrum is worked out when first needed
+  };
+
+  int rowLength;
+  int outputs;
+  int spacing;
+  int elements;
+  superpositionMode mode;
+  long fftCount, directCount;
+
+  weightSet transmit, receive;
+
+  fftPlan* plan;               // NULL until the FFT is first used
+  int fftLength;               // at least the points in every spacing-th point of a row
+  std::vector<cplx> rowSpectrum, work;
+
+  elementSuperposition(const elementSuperposition&);
+  elementSuperposition& operator=(const elementSuperposition&);
+
+  void setWeights(const cplx* weights, weightSet* set);
+  bool fftIsCheaper(bool sharedRow) const;
+  void directSumRow(const cplx* row, const weightSet& set, cplx* out) const;
+  void fftSumRows(const cplx* transRow, const cplx* recRow, cplx* transOut, cplx* recOut);
+  void spectrumOf(weightSet* set);
+  void transformRow(const cplx* row, int offset);
+  void filterRow(const weightSet& set, int offset, cplx* out);
+};
+
+#endif  // RFDATA_SUPERPOSITION_H_
@@ -1,31 +1,135 @@
 #include "./util.h"
-/*!The logic of Fresnel class is to perform fresnel integral once over wide interval,
- *and then to do 1-D interpolation to get further values of the integral.
- *Fresnel integral is symmetric
+
+#include <algorithm>
+
+namespace {
+
+// C and S are polynomials of polyOrder terms on segments up to directX, above
+// which they come from the asymptotic auxiliary functions.  C and S oscillate
+// faster as x grows, so the segments past tierX are narrower.
+const double tierX = 6;
+const double directX = 12;
+const double innerWidth = 1./32;
+const double outerWidth = 1./64;
+const int polyOrder = 6;
+const int innerSegments = static_cast<int>(tierX/innerWidth);
+const int segments = innerSegments + static_cast<int>((directX - tierX)/outerWidth);
+
+// where 0 <= ax <= directX falls in the segments, the integer part is the segment
+inline double segmentPosition(double ax) {
+    return ax < tierX ? ax/innerWidth : innerSegments + (ax - tierX)/outerWidth;
+}
+
+/*!  Segment s holds the polyOrder coefficients of C, then those of S, as powers of
+ * u = 2*(segmentPosition(x) - s) - 1.  They are fitted by Chebyshev interpolation and then
+ * turned into powers so they can be summed by Horner's rule.
  */
-fresnelInt::fresnelInt() {
-    EPSLON = 6.e-10;
-    MAXIT = 500;
-    FPMIN = 1.e-50;
-    XMIN = 1.5;
-
-    DELTAX = 4e-4;
-    LARGELIM = 30.;
-    BASESIZE = static_cast<int>(LARGELIM/DELTAX) + 1;
-    eps = 3e-15;
-
-    fresBase = new cplx[BASESIZE];
-    assert(fresBase != NULL);
-
-    for (int i=0; i < BASESIZE; i++) {
-        fresBase[i] = fresnel(i*DELTAX);
+struct fresnelTable {
+    double coef[segments*2*polyOrder];
+
+    fresnelTable() {
+        for (int s = 0; s < segments; s++) {
+            double width = s < innerSegments ? innerWidth : outerWidth;
+            double middle = s < innerSegments ? (s + 0.5)*innerWidth
+                                              : tierX + (s - innerSegments + 0.5)*outerWidth;
+            cplx node[polyOrder];
+            for (int j = 0; j < polyOrder; j++)
+                node[j] = fresnelInt::fresnel(middle + width/2*cos(M_PI*(j + 0.5)/polyOrder));
+
+            // Chebyshev coefficients, then the powers of u in each T_k added up
+            double power[polyOrder][polyOrder] = {};
+            power[0][0] = 1;
+            if (polyOrder > 1) power[1][1] = 1;
+            for (int k = 2; k < polyOrder; k++) {
+                for (int p = 0; p < polyOrder; p++) {
+                    power[k][p] = -power[k-2][p];
+                    if (p > 0) power[k][p] += 2*power[k-1][p-1];
+                }
+            }
+
+            double* c = coef + s*2*polyOrder;
+            for (int p = 0; p < 2*polyOrder; p++)
+                c[p] = 0;
+            for (int k = 0; k < polyOrder; k++) {
+                cplx sum = cplxZero;
+                for (int j = 0; j < polyOrder; j++)
+                    sum += node[j]*cos(M_PI*k*(j + 0.5)/polyOrder);
+                sum *= (k == 0 ? 1.0 : 2.0)/polyOrder;
+                for (int p = 0; p < polyOrder; p++) {
+                    c[p] += sum.real()*power[k][p];
+                    c[polyOrder + p] += sum.imag()*power[k][p];
+                }
+            }
+        }
     }
+};
+
+const fresnelTable& sharedTable() {
+    static const fresnelTable table;
+    return table;
 }
 
-fresnelInt::~fresnelInt() {
-    delete[] fresBase;
+/*!  C + iS at 0 <= ax from the table.  Arguments past directX are clamped to the last
+ * segment, so this has no branches; their values are replaced afterwards.
+ */
+inline cplx tableFresnel(const double* coefs, double ax) {
+    double position = segmentPosition(std::min(ax, directX));
+    int s = std::min(static_cast<int>(position), segments - 1);
+    double u = 2*(position - s) - 1;
+    const double* c = coefs + s*2*polyOrder;
+
+    double cSum = c[polyOrder - 1], sSum = c[2*polyOrder - 1];
+    for (int p = polyOrder - 2; p >= 0; p--) {
+        cSum = cSum*u + c[p];
+        sSum = sSum*u + c[polyOrder + p];
+    }
+    return cplx(cSum, sSum);
 }
 
+/*!  sin and cos of pi/2*s.  s modulo 4 is exact, so this is accurate however large s is.
+ * The angle is written as q quarter turns plus pi/4 plus phi with |phi| <= pi/4, and the
+ * sine and cosine of phi are Taylor series.
+ */
+inline void halfPiSinCos(double s, double* sn, double* cs) {
+    // s >= 0, so truncation is floor
+    double turns = s - 4*static_cast<double>(static_cast<int64_t>(s/4));
+    int quarter = static_cast<int>(turns);
+    double phi = M_PI/2*(turns - quarter - 0.5);
+    double p2 = phi*phi;
+    double sinPhi = phi*(1 + p2*(-1/6. + p2*(1/120. + p2*(-1/5040. + p2*(1/362880.
+                    + p2*(-1/39916800. + p2/6227020800.))))));
+    double cosPhi = 1 + p2*(-1/2. + p2*(1/24. + p2*(-1/720. + p2*(1/40320.
+                    + p2*(-1/3628800. + p2*(1/479001600. - p2/87178291200.))))));
+
+    // rotate by pi/4, then by q quarter turns
+    double sinA = M_SQRT1_2*(sinPhi + cosPhi);
+    double cosA = M_SQRT1_2*(cosPhi - sinPhi);
+    double a = quarter & 1 ? cosA : sinA;
+    double b = quarter & 1 ? sinA : cosA;
+    *sn = quarter & 2 ? -a : a;
+    *cs = (quarter + 1) & 2 ? -b : b;
+}
+
+/*!  C + iS at ax >= directX from the auxiliary functions f and g, by their asymptotic series
+ * (Abramowitz and Stegun 7.3.27, 7.3.28):
+ * C = 1/2 + f sin(pi x^2/2) - g cos(pi x^2/2), S = 1/2 - f cos(pi x^2/2) - g sin(pi x^2/2)
+ */
+inline cplx asymptoticFresnel(double ax) {
+    // one division: 1/(pi x) and 1/(pi^2 x^3) both follow from 1/(pi x^2)
+    double inverse = 1/(M_PI*ax*ax);
+    double v = inverse*inverse;
+    double f = (1 - v*(3 - v*(105 - v*(10395 - v*(2027025 - v*654729075.)))))*inverse*ax;
+    double g = (1 - v*(15 - v*(945 - v*(135135 - v*(34459425 - v*13749310575.)))))*v*ax;
+
+    double sn, cs;
+    halfPiSinCos(ax*ax, &sn, &cs);
+    return cplx(.5 + f*sn - g*cs, .5 - f*cs - g*sn);
+}
+
+}  // namespace
+
+fresnelInt::fresnelInt(): coefs(sharedTable().coef) {}
+
 /*!Code for evaluating fresnel integral straight from numerical recipes 1992 version
  * The Fresnel integrals are defined as follows:
  * \f$ S(x) = /int_0^x{ sin( \frac{\pi}{2} t^2), t } \f$
@@ -41,6 +145,12 @@ cplx fresnelInt::fresnel(double x) {
     cplx b, cc, d, h, del, cs;
     double s, c;
 
+    // tolerance, iteration limit, smallest number, series/fraction boundary
+    const double EPSLON = 1e-15;
+    const int MAXIT = 500;
+    const double FPMIN = 1.e-50;
+    const double XMIN = 1.5;
+
     ax = fabs(x);
     if (ax < sqrt(FPMIN)) {  // Input is small enough to call 0
         s = 0.0;
@@ -76,7 +186,7 @@ cplx fresnelInt::fresnel(double x) {
         pix2 = M_PI*ax*ax;
         b = 1.0 -imUnit*pix2;
         cc = 1.0/FPMIN;
-        d = h = cplxOne/b;
+        d = h = 1.0/b;
         n = -1;
         for (k=2; k <= MAXIT; k++) {
             n += 2;
@@ -88,12 +198,10 @@ cplx fresnelInt::fresnel(double x) {
             h *= del;
             if (fabs(del.real() - 1.0)+fabs(del.imag()) < EPSLON) break;
         }
-        if (k >= MAXIT)
-
         assert(k <= MAXIT);
         h *= (ax-imUnit*ax);
         cs = (.5 + imUnit*.5) *
-                  (cplxOne- (cos(.5*pix2) + imUnit*sin(.5*pix2)) *h);
+                  (1.0 - (cos(.5*pix2) + imUnit*sin(.5*pix2)) *h);
 
         c = cs.real();
         s = cs.imag();
@@ -107,53 +215,27 @@ cplx fresnelInt::fresnel(double x) {
     return returnValue;
 }
 
-/*!The fast Fresnel function uses linear interpolation of a table to find the
- * fast Fresnel integral
+/*!The fast Fresnel function evaluates a polynomial of the segment holding |x|, or for
+ * large |x| the asymptotic series.  C and S are odd.
  */
-cplx fresnelInt::fastFresnel(double x) {
-    double absx = fabs(x);
-    cplx res;
-
-    if (absx > LARGELIM) {
-        res = (.5 + 1. / (M_PI*absx) * sin(M_PI/2*absx*absx)) +
-                   imUnit * (.5 - 1./(M_PI*absx) * cos(M_PI/2*absx*absx));
-
-    } else {  // use linear interpolation with pre-calculated look up table
-        int index = static_cast<int>(absx/DELTAX);
-        res = fresBase[index];
-        double ratio = (absx - (index*DELTAX))/DELTAX;
-        res = ratio*fresBase[index+1] + (1 - ratio)*fresBase[index];
-    }
-
-    if (x < 0) {
-        res = -1.00*res;
-    }
-    return res;
+cplx fresnelInt::fastFresnel(double x) const {
+    double ax = fabs(x);
+    cplx result = ax < directX ? tableFresnel(coefs, ax) : asymptoticFresnel(ax);
+    return x < 0 ? -result : result;
 }
 
-
-/*!given two arrays, x and y, representing evenly spaced samples of a function
-along with the size of the arrays, return the value of the function at the
-intermediate point x0
+/*!  The polynomials are summed for every argument in one loop without branches, the few
+ * large arguments are redone afterwards.
  */
-double fresnelInt::interp1(double *x, double *y, int size, double x0) {
-    int left = 0;
-    int right = size-1;
-    int center;
-
-    while (right >= left) {
-        center = (left + right)/2;
-        if (x[center] >= x0)
-            right = center-1;
-        else
-            left = center+1;
+void fresnelInt::fastFresnel(const double* x, cplx* result, int n) const {
+    for (int i = 0; i < n; i++) {
+        cplx value = tableFresnel(coefs, fabs(x[i]));
+        result[i] = x[i] < 0 ? -value : value;
+    }
+    for (int i = 0; i < n; i++) {
+        if (fabs(x[i]) >= directX) {
+            cplx value = asymptoticFresnel(fabs(x[i]));
+            result[i] = x[i] < 0 ? -value : value;
+        }
     }
-    if (right < 0)
-        return(y[0]);
-    else if (left > (size-1))
-        return (y[size-1]);
-    else
-        return ( y[left] +
-                   (y[right] - y[left]) / (x[right] - x[left])
-                      * (x0 - x[left]));
 }
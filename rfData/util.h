@@ -7,12 +7,15 @@
 #include <time.h>
 #include <math.h>
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include <complex>
 #include <iostream>
 #include <fstream>
 
 typedef std::complex<double> cplx;
+typedef std::complex<float> cplxFloat;
 
 const cplx cplxZero(0.0, 0.0);
 const cplx imUnit(0.0, 1.0);
@@ -29,20 +32,50 @@ inline double mod(const vector& v) {
 }
 
 
+/*! \brief 64 bit FNV-1a hash, used to recognise identical simulation settings and inputs.
+ * Pass the previous result as h to hash several pieces of data in turn.
+ */
+const uint64_t hashSeed = 14695981039346656037ULL;
 
+inline uint64_t hashBytes(const void* data, size_t len, uint64_t h = hashSeed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+inline uint64_t hashDouble(double value, uint64_t h) {
+    return hashBytes(&value, sizeof(value), h);
+}
+
+inline uint64_t hashInt(int64_t value, uint64_t h) {
+    return hashBytes(&value, sizeof(value), h);
+}
+
+/*! \brief The Fresnel integral C(x) + i S(x).
+ *
+ * Below directX, C and S are polynomials on short segments.  Above it they come from
+ * the asymptotic series of the auxiliary functions f and g:
+ * C(x) = 1/2 + f(x) sin(pi x^2/2) - g(x) cos(pi x^2/2)
+ * S(x) = 1/2 - f(x) cos(pi x^2/2) - g(x) sin(pi x^2/2)
+ * The coefficients take 55 kilobytes and stay in cache.  They are calculated once per
+ * process and shared by every fresnelInt.
+ */
 class fresnelInt {
  public:
   fresnelInt();
-  ~fresnelInt();
-  cplx fastFresnel(double x);
+  cplx fastFresnel(double x) const;
 
- private:
-  cplx *fresBase;
-  cplx fresnel(double x);
-  double interp1(double *x, double *y, int size, double x0);
+  // the same for n arguments at a time, in loops without branches
+  void fastFresnel(const double* x, cplx* result, int n) const;
 
-  double EPSLON, FPMIN, DELTAX, LARGELIM, XMIN, eps;
-  int MAXIT, BASESIZE;
+  // series or continued fraction, slow but accurate to about 1e-15
+  static cplx fresnel(double x);
+
+ private:
+  const double* coefs;  // the shared polynomial coefficients
 };
 
 #endif  // RFDATA_UTIL_H_